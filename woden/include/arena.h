@@ -0,0 +1,39 @@
+/* Arena - A bump allocator for compile-time data
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef WODEN_ARENA_H
+#define WODEN_ARENA_H
+
+#include <stddef.h>
+
+typedef struct arena arena_t;
+typedef struct arena_block arena_block_t;
+
+struct arena {
+    arena_block_t* blocks;
+};
+
+extern void arena_init(arena_t* arena);
+extern void arena_free(arena_t* arena);
+
+extern void* arena_alloc(arena_t* arena, size_t size);
+extern void* arena_resize(arena_t* arena, void* target, size_t old_size, size_t size);
+extern void arena_release(arena_t* arena, void* target);
+
+#endif // WODEN_ARENA_H
@@ -22,10 +22,21 @@
 
 #include <malloc.h>
 
+#include "arena.h"
+
 #define array_alloc(type, size) \
     (type*) malloc(sizeof(type) * (size))
 
 #define array_resize(type, array, size) \
     array = (type*) realloc(array, sizeof(type) * (size))
 
+#define arena_array_alloc(arena, type, size) \
+    (type*) arena_alloc(arena, sizeof(type) * (size))
+
+#define arena_array_resize(arena, type, array, old_size, size) \
+    array = (type*) arena_resize(arena, array, sizeof(type) * (old_size), sizeof(type) * (size))
+
+#define arena_array_free(arena, array) \
+    arena_release(arena, array)
+
 #endif // WODEN_MEMORY_H
@@ -24,13 +24,19 @@
 #include <inttypes.h>
 
 #include "varray.h"
+#include "arena.h"
+
+#define CONSTANTS_MAX ((1 << 24) - 1)
+#define JUMP_MAX UINT16_MAX
 
 typedef struct chunk chunk_t;
-typedef uint32_t byte_t;
+typedef struct line line_t;
+typedef uint8_t byte_t;
 typedef enum operation operation_t;
 
 enum operation {
     OP_CONSTANT,
+    OP_CONSTANT_LONG,
     OP_NULL,
     OP_TRUE,
     OP_FALSE,
@@ -52,23 +58,65 @@ enum operation {
     OP_PRINT,
     OP_POP,
     OP_DEFINE_GLOBAL,
+    OP_DEFINE_GLOBAL_LONG,
     OP_GET_GLOBAL,
+    OP_GET_GLOBAL_LONG,
     OP_SET_GLOBAL,
+    OP_SET_GLOBAL_LONG,
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
+    OP_ADD_LOCALS,
+    OP_LESS_LOCAL_CONSTANT,
+    OP_ADD_LOCAL_CONSTANT,
+    OP_ADD_GLOBAL_CONSTANT,
+    OP_JUMP,
+    OP_JUMP_IF_FALSE,
+    OP_LOOP,
+    OP_FOR_LESS_CONSTANT,
+    OP_FOR_LESS_LOCAL,
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_LESS_NUM,
+    OP_LESS_EQUAL_NUM,
+    OP_GREATER_NUM,
+    OP_GREATER_EQUAL_NUM,
+    OP_ADD_ANY,
+    OP_CALL,
+    OP_TAIL_CALL,
     OP_RETURN
 };
 
+struct line {
+    uint32_t offset;
+    uint32_t line;
+};
+
 struct chunk {
     size_t size;
     size_t length;
     byte_t* code;
-    size_t* lines;
+    size_t lines_size;
+    size_t lines_length;
+    line_t* lines;
     varray_t constants;
+    size_t depth;
+    size_t lookup_size;
+    size_t* lookup;
+    void* image;
+    size_t image_size;
+    arena_t arena;
 };
 
 extern void chunk_init(chunk_t* chunk);
 extern void chunk_free(chunk_t* chunk);
 
-extern byte_t chunk_value(chunk_t* chunk, value_t value);
+extern size_t chunk_value(chunk_t* chunk, value_t value);
 extern void chunk_write(chunk_t* chunk, byte_t byte, size_t line);
+extern void chunk_truncate(chunk_t* chunk, size_t length);
+extern size_t chunk_line(chunk_t* chunk, size_t offset);
+extern size_t chunk_depth(chunk_t* chunk);
+extern size_t chunk_operation_size(byte_t operation);
 
 #endif // WODEN_CHUNK_H
@@ -24,6 +24,8 @@
 
 #include "chunk.h"
 
+extern const char* operation_name(byte_t operation);
+
 extern void disassemble_chunk(chunk_t* chunk, const char* name);
 extern size_t disassemble_operation(chunk_t* chunk, size_t offset);
 
@@ -0,0 +1,60 @@
+/* GC - Mark-and-sweep garbage collector
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef WODEN_GC_H
+#define WODEN_GC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "value.h"
+#include "varray.h"
+
+typedef struct gc_stats gc_stats_t;
+typedef void (*gc_roots_t)(void*);
+
+struct gc_stats {
+    size_t collections;
+    size_t live_bytes;
+    size_t freed_bytes;
+    size_t last_freed_bytes;
+    uint64_t pause_time;
+    uint64_t last_pause_time;
+};
+
+extern void gc_track(object_t* object);
+extern bool gc_pending(void);
+extern void gc_collect(gc_roots_t roots, void* data);
+extern const void* gc_heap(void);
+extern void gc_free(void);
+
+// Pinned objects survive collections without being reachable from any
+// root. Chunks pin their constants, so compiled code stays valid
+// between runs.
+extern void gc_pin(value_t value);
+extern void gc_unpin(value_t value);
+
+extern void gc_mark_object(object_t* object);
+extern void gc_mark_value(value_t value);
+extern void gc_mark_varray(varray_t* array);
+
+extern gc_stats_t gc_stats(void);
+
+#endif // WODEN_GC_H
@@ -24,29 +24,53 @@
 #include <inttypes.h>
 
 #include "value.h"
+#include "chunk.h"
+#include "table.h"
 
 #define OBJECT_TYPE(value) (AS_OBJECT(value)->type)
 
 #define IS_STRING(value) is_object_type(value, OBJ_STRING)
+#define IS_FUNCTION(value) is_object_type(value, OBJ_FUNCTION)
 
 #define AS_STRING(value)       ((string_t*)AS_OBJECT(value))
 #define AS_CSTRING(value)      (((string_t*)AS_OBJECT(value))->target)
+#define AS_FUNCTION(value)     ((function_t*)AS_OBJECT(value))
 
+typedef struct function function_t;
 typedef enum object_type object_type_t;
 
 enum object_type {
-    OBJ_STRING
+    OBJ_STRING,
+    OBJ_FUNCTION
 };
 
 struct object {
     object_type_t type;
+    bool marked;
+    uint32_t pins;
+    object_t* next;
 };
 
 struct string {
     object_t object;
     size_t size;
-    char* target;
     uint32_t hash;
+    char target[];
+};
+
+// A function compiled on one thread can be called on others through a
+// copy made there: the copy runs the code of `source`, with constants
+// and global caches from its own heap.
+struct function {
+    object_t object;
+    size_t arity;
+    string_t* name;
+    chunk_t chunk;
+    chunk_t* body;
+    value_t* constants;
+    table_cache_t* caches;
+    function_t* source;
+    const void* heap;
 };
 
 static inline bool is_object_type(value_t value, object_type_t type) {
@@ -54,7 +78,16 @@ static inline bool is_object_type(value_t value, object_type_t type) {
 }
 
 extern void object_print(value_t value);
+extern size_t object_size(object_t* object);
+extern void object_free(object_t* object);
+
+extern void string_sweep(void);
+extern void string_free_all(void);
 extern string_t* string_copy(const char* string, size_t size);
-extern string_t* string_make(char* string, size_t size);
+extern string_t* string_concat(string_t* x, string_t* y);
+
+extern function_t* function_new(string_t* name);
+extern function_t* function_copy(function_t* source);
+extern void function_prepare(function_t* function);
 
 #endif // WODEN_OBJECT_H
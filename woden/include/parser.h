@@ -24,6 +24,6 @@
 
 #include "chunk.h"
 
-extern bool parser_parse(chunk_t* chunk, const char* source);
+extern bool parser_parse(chunk_t* chunk, const char* source, bool optimize);
 
 #endif // WODEN_PARSER_H
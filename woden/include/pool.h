@@ -0,0 +1,29 @@
+/* Pool - A size-class allocator for runtime objects
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef WODEN_POOL_H
+#define WODEN_POOL_H
+
+#include <stddef.h>
+
+extern void* pool_alloc(size_t size);
+extern void pool_free(void* target, size_t size);
+extern void pool_release(void);
+
+#endif // WODEN_POOL_H
@@ -0,0 +1,78 @@
+/* Registers - Register-based bytecode
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef WODEN_REGISTERS_H
+#define WODEN_REGISTERS_H
+
+#include <stdbool.h>
+
+#include "chunk.h"
+
+#define REGISTERS_SIZE (UINT8_MAX + 1)
+
+// Three-address operations over frame slots. Every operand is one
+// byte: a slot, or a constant index (_LONG forms take 24 bits as in
+// the stack code). The destination slot always comes first. Jumps take
+// a 16-bit offset from the end of the instruction, as in the stack code.
+typedef enum register_operation register_operation_t;
+
+enum register_operation {
+    REG_CONSTANT,
+    REG_CONSTANT_LONG,
+    REG_NULL,
+    REG_TRUE,
+    REG_FALSE,
+    REG_MOVE,
+    REG_NOT,
+    REG_NEGATE,
+    REG_DIVIDE,
+    REG_MULTIPLY,
+    REG_MODULO,
+    REG_SUBTRACT,
+    REG_ADD,
+    REG_EQUAL,
+    REG_NOT_EQUAL,
+    REG_LESS,
+    REG_LESS_EQUAL,
+    REG_GREATER,
+    REG_GREATER_EQUAL,
+    REG_AND,
+    REG_OR,
+    REG_PRINT,
+    REG_DEFINE_GLOBAL,
+    REG_DEFINE_GLOBAL_LONG,
+    REG_GET_GLOBAL,
+    REG_GET_GLOBAL_LONG,
+    REG_SET_GLOBAL,
+    REG_SET_GLOBAL_LONG,
+    REG_JUMP,
+    REG_JUMP_IF_FALSE,
+    REG_LOOP,
+    REG_FOR_LESS_CONSTANT,
+    REG_FOR_LESS_LOCAL,
+    REG_RETURN
+};
+
+// Translates the stack code of `source` into register code in
+// `target`. The register code indexes the constant pool of `source`.
+// Returns false when the code needs more slots than a frame has, or
+// makes calls, which only the stack engine runs.
+extern bool registers_compile(chunk_t* target, chunk_t* source);
+
+#endif // WODEN_REGISTERS_H
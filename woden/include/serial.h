@@ -0,0 +1,36 @@
+/* Serial - Bytecode serialization
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef WODEN_SERIAL_H
+#define WODEN_SERIAL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "chunk.h"
+
+#define SERIAL_VERSION 10
+
+extern uint64_t serial_hash(const char* source, size_t size, bool optimize);
+
+extern bool serial_save(chunk_t* chunk, const char* path, uint64_t hash);
+extern bool serial_load(chunk_t* chunk, const char* path, uint64_t hash);
+
+#endif // WODEN_SERIAL_H
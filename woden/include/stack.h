@@ -20,18 +20,34 @@
 #ifndef WODEN_STACK_H
 #define WODEN_STACK_H
 
+#include <stddef.h>
+#include <stdbool.h>
+
 #include "value.h"
 
 #define STACK_SIZE 256
 
+#ifndef STACK_LIMIT
+#   define STACK_LIMIT (1 << 20)
+#endif
+
 typedef struct stack stack_t;
 
+// Pushes are unchecked: code reserves the depth it needs up front
+// (see chunk_t.depth), so the bounds check runs once per entry instead
+// of once per push.
 struct stack {
     value_t* current;
-    value_t values[STACK_SIZE];
+    value_t* values;
+    size_t size;
+    size_t limit;
 };
 
-static inline void stack_init(stack_t* stack) {
+extern void stack_init(stack_t* stack, size_t limit);
+extern void stack_free(stack_t* stack);
+extern bool stack_reserve(stack_t* stack, size_t depth);
+
+static inline void stack_reset(stack_t* stack) {
     stack->current = stack->values;
 }
 
@@ -21,22 +21,40 @@
 #define WODEN_TABLE_H
 
 #include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
 
 #include "value.h"
 
-#define TABLE_SIZE 10
-
 typedef struct table table_t;
 typedef struct table_storage table_storage_t;
+typedef struct table_cache table_cache_t;
 
 struct table {
-    table_storage_t* storages[TABLE_SIZE];
+    size_t size;
+    size_t length;
+    // Changed whenever pointers returned by table_get may go stale.
+    // Versions are never reused by another table of the same thread.
+    size_t version;
+    table_storage_t* storages;
+};
+
+// A value pointer from table_get, valid while the version matches.
+struct table_cache {
+    value_t* value;
+    size_t version;
 };
 
 extern void table_init(table_t* table);
 extern void table_free(table_t* table);
 
 extern value_t* table_get(table_t* table, string_t* key);
-extern void table_set(table_t* table, string_t* key, value_t value);
+extern bool table_set(table_t* table, string_t* key, value_t value);
+extern bool table_delete(table_t* table, string_t* key);
+
+extern void table_mark(table_t* table);
+extern void table_sweep(table_t* table);
+
+extern string_t* table_find_string(table_t* table, const char* chars, size_t size, uint32_t hash);
 
 #endif // WODEN_TABLE_H
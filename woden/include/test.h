@@ -21,5 +21,10 @@
 #define WODEN_TEST_H
 
 extern void add_varray_tests(void);
+extern void add_value_tests(void);
+extern void add_table_tests(void);
+extern void add_gc_tests(void);
+extern void add_chunk_tests(void);
+extern void add_vm_tests(void);
 
 #endif // WODEN_TEST_H
@@ -21,6 +21,53 @@
 #define WODEN_VALUE_H
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct object object_t;
+typedef struct string string_t;
+
+#ifdef WODEN_NAN_BOXING
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NULL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+
+#define NULL_VAL ((value_t)(QNAN | TAG_NULL))
+#define FALSE_VAL ((value_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((value_t)(QNAN | TAG_TRUE))
+#define BOOL_VAL(value) ((value) ? TRUE_VAL : FALSE_VAL)
+#define NUMBER_VAL(value) number_to_value(value)
+#define OBJECT_VAL(value) ((value_t)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(value)))
+
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) value_to_number(value)
+#define AS_OBJECT(value) ((object_t*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define IS_NULL(value) ((value) == NULL_VAL)
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJECT(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define ARE_NUMBERS(x, y) ((((x) & QNAN) != QNAN) & (((y) & QNAN) != QNAN))
+
+typedef uint64_t value_t;
+
+static inline value_t number_to_value(double number) {
+    value_t value;
+    memcpy(&value, &number, sizeof(double));
+    return value;
+}
+
+static inline double value_to_number(value_t value) {
+    double number;
+    memcpy(&number, &value, sizeof(value_t));
+    return number;
+}
+
+#else
 
 #define NULL_VAL ((value_t){ VAL_NULL, { .number = 0 } })
 #define BOOL_VAL(value) ((value_t){ VAL_BOOL, { .boolean = value } })
@@ -35,10 +82,9 @@
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJECT(value) ((value).type == VAL_OBJECT)
+#define ARE_NUMBERS(x, y) ((((x).type ^ VAL_NUMBER) | ((y).type ^ VAL_NUMBER)) == 0)
 
 typedef struct value value_t;
-typedef struct object object_t;
-typedef struct string string_t;
 typedef enum value_type value_type_t;
 
 enum value_type {
@@ -57,6 +103,8 @@ struct value {
     } as;
 };
 
+#endif // WODEN_NAN_BOXING
+
 extern void value_print(value_t value);
 
 extern bool value_equal(value_t x, value_t y);
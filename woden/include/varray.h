@@ -23,6 +23,7 @@
 #include <stddef.h>
 
 #include "value.h"
+#include "arena.h"
 
 typedef struct varray varray_t;
 
@@ -30,9 +31,11 @@ struct varray {
     size_t size;
     size_t length;
     value_t* values;
+    arena_t* arena;
 };
 
 extern void varray_init(varray_t* array);
+extern void varray_init_arena(varray_t* array, arena_t* arena);
 extern void varray_free(varray_t* array);
 
 extern void varray_push(varray_t* array, value_t value);
@@ -20,9 +20,15 @@
 #ifndef WODEN_VM_H
 #define WODEN_VM_H
 
+#include <stdbool.h>
+
 #include "chunk.h"
+#include "value.h"
 
+typedef struct vm vm_t;
 typedef enum vm_result vm_result_t;
+typedef enum vm_engine vm_engine_t;
+typedef struct vm_stats vm_stats_t;
 
 enum vm_result {
     VM_SUCCESS,
@@ -30,6 +36,44 @@ enum vm_result {
     VM_RUNTIME_ERROR
 };
 
-extern vm_result_t vm_run(chunk_t* chunk);
+// The register engine runs code translated from the stack code. It
+// does not translate calls yet, so a VM_REGISTERS VM runs any chunk that
+// defines or calls a function on the stack engine instead, and counts
+// that in vm_stats().fallbacks.
+enum vm_engine {
+    VM_STACK,
+    VM_REGISTERS
+};
+
+// The stack engine rewrites arithmetic that sees two numbers into a
+// form specialized for them. An addition that later sees anything else
+// is rewritten once more, into a form that never specializes again.
+// These count both events over the life of a VM, and
+// the runs of a register VM that fell back to the stack engine.
+struct vm_stats {
+    size_t quickened;
+    size_t deopted;
+    size_t fallbacks;
+};
+
+// A VM keeps its globals between runs, so a host can load a script once
+// and then run further code against the same state. Every live VM is a
+// root for the garbage collector.
+extern vm_t* vm_create(vm_engine_t engine);
+extern void vm_destroy(vm_t* vm);
+
+extern vm_result_t vm_interpret(vm_t* vm, const char* source);
+extern vm_result_t vm_execute(vm_t* vm, chunk_t* chunk);
+
+// Calls the global function `name` with `count` arguments. Calls always
+// run on the stack engine.
+extern vm_result_t vm_call(vm_t* vm, const char* name, value_t* args, size_t count, value_t* result);
+
+extern bool vm_get_global(vm_t* vm, const char* name, value_t* value);
+extern void vm_set_global(vm_t* vm, const char* name, value_t value);
+
+extern vm_stats_t vm_stats(vm_t* vm);
+
+extern vm_result_t vm_run(chunk_t* chunk, vm_engine_t engine);
 
 #endif // WODEN_VM_H
@@ -0,0 +1,122 @@
+/* Arena - A bump allocator for compile-time data
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define BLOCK_SIZE (64 * 1024)
+#define ALIGNMENT 16
+
+#define align(size) (((size) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+#define is_oversized(size) (align(size) > BLOCK_SIZE / 4)
+
+struct arena_block {
+    arena_block_t* next;
+    size_t size;
+    size_t used;
+    size_t last;
+    _Alignas(ALIGNMENT) char data[];
+};
+
+static arena_block_t* block_alloc(arena_t* arena, size_t size) {
+    arena_block_t* block = (arena_block_t*) malloc(sizeof(arena_block_t) + size);
+    block->size = size;
+    block->used = 0;
+    block->last = 0;
+
+    if (size == BLOCK_SIZE || arena->blocks == NULL) {
+        block->next = arena->blocks;
+        arena->blocks = block;
+    } else {
+        // Oversized blocks go behind the current one so it keeps bumping.
+        block->next = arena->blocks->next;
+        arena->blocks->next = block;
+    }
+    return block;
+}
+
+extern void arena_init(arena_t* arena) {
+    arena->blocks = NULL;
+}
+
+extern void arena_free(arena_t* arena) {
+    while (arena->blocks != NULL) {
+        arena_block_t* block = arena->blocks;
+        arena->blocks = block->next;
+        free(block);
+    }
+}
+
+extern void* arena_alloc(arena_t* arena, size_t size) {
+    if (arena == NULL) {
+        return malloc(size);
+    }
+
+    if (is_oversized(size)) {
+        arena_block_t* block = block_alloc(arena, align(size));
+        block->used = size;
+        return block->data;
+    }
+
+    size = align(size);
+    arena_block_t* block = arena->blocks;
+    if (block == NULL || block->size - block->used < size) {
+        block = block_alloc(arena, BLOCK_SIZE);
+    }
+
+    block->last = block->used;
+    block->used += size;
+    return block->data + block->last;
+}
+
+extern void* arena_resize(arena_t* arena, void* target, size_t old_size, size_t size) {
+    if (arena == NULL) {
+        return realloc(target, size);
+    }
+
+    if (is_oversized(old_size) && is_oversized(size)) {
+        // Oversized allocations own their block, so let realloc move it.
+        for (arena_block_t** block = &arena->blocks; *block != NULL; block = &(*block)->next) {
+            if ((*block)->data == target) {
+                *block = (arena_block_t*) realloc(*block, sizeof(arena_block_t) + align(size));
+                (*block)->size = (*block)->used = align(size);
+                return (*block)->data;
+            }
+        }
+    }
+
+    arena_block_t* block = arena->blocks;
+    if (block != NULL && target == block->data + block->last
+        && block->last + align(size) <= block->size) {
+        block->used = block->last + align(size);
+        return target;
+    }
+
+    void* result = arena_alloc(arena, size);
+    memcpy(result, target, old_size < size ? old_size : size);
+    return result;
+}
+
+extern void arena_release(arena_t* arena, void* target) {
+    if (arena == NULL) {
+        free(target);
+    }
+}
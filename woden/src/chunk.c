@@ -17,38 +17,252 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
 #include "chunk.h"
 #include "array.h"
+#include "gc.h"
 
 #define BASE_SIZE 4
+#define MAX_LOAD(size) ((size) / 4 * 3)
+
+typedef struct operation_info operation_info_t;
+
+// Encoded size, net stack effect and the most the operation has on the
+// stack above its starting depth at any point.
+struct operation_info {
+    uint8_t size;
+    int8_t effect;
+    uint8_t peak;
+};
+
+static const operation_info_t operations[] = {
+    [OP_CONSTANT] = { 2, 1, 1 },
+    [OP_CONSTANT_LONG] = { 4, 1, 1 },
+    [OP_NULL] = { 1, 1, 1 },
+    [OP_TRUE] = { 1, 1, 1 },
+    [OP_FALSE] = { 1, 1, 1 },
+    [OP_NOT] = { 1, 0, 0 },
+    [OP_NEGATE] = { 1, 0, 0 },
+    [OP_DIVIDE] = { 1, -1, 0 },
+    [OP_MULTIPLY] = { 1, -1, 0 },
+    [OP_MODULO] = { 1, -1, 0 },
+    [OP_SUBTRACT] = { 1, -1, 0 },
+    [OP_ADD] = { 1, -1, 0 },
+    [OP_EQUAL] = { 1, -1, 0 },
+    [OP_NOT_EQUAL] = { 1, -1, 0 },
+    [OP_LESS] = { 1, -1, 0 },
+    [OP_LESS_EQUAL] = { 1, -1, 0 },
+    [OP_GREATER] = { 1, -1, 0 },
+    [OP_GREATER_EQUAL] = { 1, -1, 0 },
+    [OP_AND] = { 1, -1, 0 },
+    [OP_OR] = { 1, -1, 0 },
+    [OP_PRINT] = { 1, -1, 0 },
+    [OP_POP] = { 1, -1, 0 },
+    [OP_DEFINE_GLOBAL] = { 2, -1, 0 },
+    [OP_DEFINE_GLOBAL_LONG] = { 4, -1, 0 },
+    [OP_GET_GLOBAL] = { 2, 1, 1 },
+    [OP_GET_GLOBAL_LONG] = { 4, 1, 1 },
+    [OP_SET_GLOBAL] = { 2, 0, 0 },
+    [OP_SET_GLOBAL_LONG] = { 4, 0, 0 },
+    [OP_GET_LOCAL] = { 2, 1, 1 },
+    [OP_SET_LOCAL] = { 2, 0, 0 },
+    [OP_ADD_LOCALS] = { 3, 1, 2 },
+    [OP_LESS_LOCAL_CONSTANT] = { 3, 1, 1 },
+    [OP_ADD_LOCAL_CONSTANT] = { 3, 0, 2 },
+    [OP_ADD_GLOBAL_CONSTANT] = { 3, 0, 2 },
+    [OP_JUMP] = { 3, 0, 0 },
+    [OP_JUMP_IF_FALSE] = { 3, 0, 0 },
+    [OP_LOOP] = { 3, 0, 0 },
+    [OP_FOR_LESS_CONSTANT] = { 6, 0, 0 },
+    [OP_FOR_LESS_LOCAL] = { 6, 0, 0 },
+    [OP_ADD_NUM] = { 1, -1, 0 },
+    [OP_SUBTRACT_NUM] = { 1, -1, 0 },
+    [OP_MULTIPLY_NUM] = { 1, -1, 0 },
+    [OP_DIVIDE_NUM] = { 1, -1, 0 },
+    [OP_LESS_NUM] = { 1, -1, 0 },
+    [OP_LESS_EQUAL_NUM] = { 1, -1, 0 },
+    [OP_GREATER_NUM] = { 1, -1, 0 },
+    [OP_GREATER_EQUAL_NUM] = { 1, -1, 0 },
+    [OP_ADD_ANY] = { 1, -1, 0 },
+    [OP_CALL] = { 2, 0, 0 },
+    [OP_TAIL_CALL] = { 2, 0, 0 },
+    [OP_RETURN] = { 1, -1, 0 }
+};
+
+static uint64_t value_bits(value_t value) {
+#ifdef WODEN_NAN_BOXING
+    return value;
+#else
+    uint64_t bits = 0;
+    if (IS_NUMBER(value)) {
+        memcpy(&bits, &AS_NUMBER(value), sizeof(double));
+    } else if (IS_OBJECT(value)) {
+        bits = (uint64_t)(uintptr_t) AS_OBJECT(value);
+    } else if (IS_BOOL(value)) {
+        bits = AS_BOOL(value);
+    }
+    return bits ^ ((uint64_t) value.type << 56);
+#endif
+}
+
+static inline bool same_constant(value_t x, value_t y) {
+#ifdef WODEN_NAN_BOXING
+    return x == y;
+#else
+    return x.type == y.type && value_bits(x) == value_bits(y);
+#endif
+}
+
+static inline size_t value_hash(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdu;
+    bits ^= bits >> 33;
+    return (size_t) bits;
+}
+
+static size_t* lookup_find(chunk_t* chunk, value_t value) {
+    size_t mask = chunk->lookup_size - 1;
+    for (size_t index = value_hash(value_bits(value)) & mask;; index = (index + 1) & mask) {
+        size_t* slot = &chunk->lookup[index];
+        if (*slot == 0 || same_constant(chunk->constants.values[*slot - 1], value)) {
+            return slot;
+        }
+    }
+}
+
+static void lookup_resize(chunk_t* chunk, size_t size) {
+    chunk->lookup_size = size;
+    chunk->lookup = arena_array_alloc(&chunk->arena, size_t, size);
+    memset(chunk->lookup, 0, sizeof(size_t) * size);
+
+    for (size_t i = 0; i < chunk->constants.length; ++i) {
+        *lookup_find(chunk, chunk->constants.values[i]) = i + 1;
+    }
+}
 
 extern void chunk_init(chunk_t* chunk) {
+    arena_init(&chunk->arena);
     chunk->size = BASE_SIZE;
     chunk->length = 0;
-    chunk->code = array_alloc(byte_t, BASE_SIZE);
-    chunk->lines = array_alloc(size_t, BASE_SIZE);
-    varray_init(&chunk->constants);
+    chunk->code = arena_array_alloc(&chunk->arena, byte_t, BASE_SIZE);
+    chunk->lines_size = BASE_SIZE;
+    chunk->lines_length = 0;
+    chunk->lines = arena_array_alloc(&chunk->arena, line_t, BASE_SIZE);
+    varray_init_arena(&chunk->constants, &chunk->arena);
+    chunk->depth = 0;
+    chunk->lookup_size = 0;
+    chunk->lookup = NULL;
+    chunk->image = NULL;
+    chunk->image_size = 0;
 }
 
 extern void chunk_free(chunk_t* chunk) {
-    free(chunk->code);
-    free(chunk->lines);
-    varray_free(&chunk->constants);
+    for (size_t i = 0; i < chunk->constants.length; ++i) {
+        gc_unpin(chunk->constants.values[i]);
+    }
+    if (chunk->image != NULL) {
+        munmap(chunk->image, chunk->image_size);
+    }
+    arena_free(&chunk->arena);
 }
 
-extern uint32_t chunk_value(chunk_t* chunk, value_t value) {
-    varray_push(&chunk->constants, value);
-    return chunk->constants.length - 1;
+extern size_t chunk_value(chunk_t* chunk, value_t value) {
+    if (chunk->constants.length + 1 > MAX_LOAD(chunk->lookup_size)) {
+        lookup_resize(chunk, chunk->lookup_size < BASE_SIZE ? BASE_SIZE * 2 : chunk->lookup_size * 2);
+    }
+
+    size_t* slot = lookup_find(chunk, value);
+    if (*slot == 0) {
+        varray_push(&chunk->constants, value);
+        gc_pin(value);
+        *slot = chunk->constants.length;
+    }
+    return *slot - 1;
 }
 
 extern void chunk_write(chunk_t* chunk, byte_t byte, size_t line) {
     if (chunk->length == chunk->size) {
         chunk->size *= 2;
-        array_resize(size_t, chunk->lines, chunk->size);
-        array_resize(byte_t, chunk->code, chunk->size);
+        arena_array_resize(&chunk->arena, byte_t, chunk->code, chunk->length, chunk->size);
+    }
+
+    if (chunk->lines_length == 0 || chunk->lines[chunk->lines_length - 1].line != line) {
+        if (chunk->lines_length == chunk->lines_size) {
+            chunk->lines_size *= 2;
+            arena_array_resize(&chunk->arena, line_t, chunk->lines, chunk->lines_length, chunk->lines_size);
+        }
+        chunk->lines[chunk->lines_length++] = (line_t) { (uint32_t) chunk->length, (uint32_t) line };
     }
 
-    chunk->lines[chunk->length] = line;
-    chunk->code[chunk->length] = (byte_t) byte;
+    chunk->code[chunk->length] = byte;
     ++chunk->length;
 }
+
+extern void chunk_truncate(chunk_t* chunk, size_t length) {
+    if (length >= chunk->length) return;
+
+    while (chunk->lines_length > 0 && chunk->lines[chunk->lines_length - 1].offset >= length) {
+        --chunk->lines_length;
+    }
+    chunk->length = length;
+}
+
+extern size_t chunk_operation_size(byte_t operation) {
+    if (operation >= sizeof(operations) / sizeof(operations[0]) || operations[operation].size == 0) {
+        return 1;
+    }
+    return operations[operation].size;
+}
+
+// A call replaces the callee and its arguments with the result, and
+// the callee's own frame is reserved when it is entered. Statements
+// leave the stack as they found it, so the only code a straight scan
+// gets wrong is code reached by a forward jump, which starts at the
+// depth the jump left.
+extern size_t chunk_depth(chunk_t* chunk) {
+    ptrdiff_t* targets = calloc(chunk->length + 1, sizeof(ptrdiff_t));
+    ptrdiff_t depth = 0;
+    ptrdiff_t max = 0;
+    for (size_t offset = 0; offset < chunk->length;) {
+        byte_t* code = &chunk->code[offset];
+        if (targets[offset] != 0) {
+            depth = targets[offset] - 1;
+        }
+
+        operation_info_t info = operations[*code];
+        ptrdiff_t effect = info.effect;
+        if (*code == OP_CALL || *code == OP_TAIL_CALL) {
+            effect = -(ptrdiff_t) code[1];
+        } else if (*code == OP_JUMP || *code == OP_JUMP_IF_FALSE) {
+            size_t target = offset + 3 + (code[1] | code[2] << 8);
+            if (target <= chunk->length) {
+                targets[target] = depth + 1;
+            }
+        }
+
+        if (depth + info.peak > max) {
+            max = depth + info.peak;
+        }
+        depth += effect;
+        offset += chunk_operation_size(*code);
+    }
+    free(targets);
+    return (size_t) max;
+}
+
+extern size_t chunk_line(chunk_t* chunk, size_t offset) {
+    size_t low = 0;
+    size_t high = chunk->lines_length;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (chunk->lines[middle].offset <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    return chunk->lines_length == 0 ? 0 : chunk->lines[low].line;
+}
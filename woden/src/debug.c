@@ -22,11 +22,71 @@
 #include "debug.h"
 #include "value.h"
 
+static const char* names[] = {
+    [OP_CONSTANT] = "OP_CONSTANT",
+    [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+    [OP_NULL] = "OP_NULL",
+    [OP_TRUE] = "OP_TRUE",
+    [OP_FALSE] = "OP_FALSE",
+    [OP_NOT] = "OP_NOT",
+    [OP_NEGATE] = "OP_NEGATE",
+    [OP_DIVIDE] = "OP_DIVIDE",
+    [OP_MULTIPLY] = "OP_MULTIPLY",
+    [OP_MODULO] = "OP_MODULO",
+    [OP_SUBTRACT] = "OP_SUBTRACT",
+    [OP_ADD] = "OP_ADD",
+    [OP_EQUAL] = "OP_EQUAL",
+    [OP_NOT_EQUAL] = "OP_NOT_EQUAL",
+    [OP_LESS] = "OP_LESS",
+    [OP_LESS_EQUAL] = "OP_LESS_EQUAL",
+    [OP_GREATER] = "OP_GREATER",
+    [OP_GREATER_EQUAL] = "OP_GREATER_EQUAL",
+    [OP_AND] = "OP_AND",
+    [OP_OR] = "OP_OR",
+    [OP_PRINT] = "OP_PRINT",
+    [OP_POP] = "OP_POP",
+    [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+    [OP_DEFINE_GLOBAL_LONG] = "OP_DEFINE_GLOBAL_LONG",
+    [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+    [OP_GET_GLOBAL_LONG] = "OP_GET_GLOBAL_LONG",
+    [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+    [OP_SET_GLOBAL_LONG] = "OP_SET_GLOBAL_LONG",
+    [OP_GET_LOCAL] = "OP_GET_LOCAL",
+    [OP_SET_LOCAL] = "OP_SET_LOCAL",
+    [OP_ADD_LOCALS] = "OP_ADD_LOCALS",
+    [OP_LESS_LOCAL_CONSTANT] = "OP_LESS_LOCAL_CONSTANT",
+    [OP_ADD_LOCAL_CONSTANT] = "OP_ADD_LOCAL_CONSTANT",
+    [OP_ADD_GLOBAL_CONSTANT] = "OP_ADD_GLOBAL_CONSTANT",
+    [OP_JUMP] = "OP_JUMP",
+    [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+    [OP_LOOP] = "OP_LOOP",
+    [OP_FOR_LESS_CONSTANT] = "OP_FOR_LESS_CONSTANT",
+    [OP_FOR_LESS_LOCAL] = "OP_FOR_LESS_LOCAL",
+    [OP_ADD_NUM] = "OP_ADD_NUM",
+    [OP_SUBTRACT_NUM] = "OP_SUBTRACT_NUM",
+    [OP_MULTIPLY_NUM] = "OP_MULTIPLY_NUM",
+    [OP_DIVIDE_NUM] = "OP_DIVIDE_NUM",
+    [OP_LESS_NUM] = "OP_LESS_NUM",
+    [OP_LESS_EQUAL_NUM] = "OP_LESS_EQUAL_NUM",
+    [OP_GREATER_NUM] = "OP_GREATER_NUM",
+    [OP_GREATER_EQUAL_NUM] = "OP_GREATER_EQUAL_NUM",
+    [OP_ADD_ANY] = "OP_ADD_ANY",
+    [OP_CALL] = "OP_CALL",
+    [OP_TAIL_CALL] = "OP_TAIL_CALL",
+    [OP_RETURN] = "OP_RETURN"
+};
+
 static size_t simple_operation(const char* name, size_t offset) {
     printf("%s\n", name);
     return offset + 1;
 }
 
+static size_t byte_operation(const char* name, chunk_t* chunk, size_t offset) {
+    size_t slot = (size_t) chunk->code[offset + 1];
+    printf("%-16s %4zu\n", name, slot);
+    return offset + 2;
+}
+
 static size_t const_operation(const char* name, chunk_t* chunk, size_t offset) {
     size_t constant = (size_t) chunk->code[offset + 1];
     printf("%-16s %4zu '", name, constant);
@@ -35,6 +95,42 @@ static size_t const_operation(const char* name, chunk_t* chunk, size_t offset) {
     return offset + 2;
 }
 
+static size_t const_long_operation(const char* name, chunk_t* chunk, size_t offset) {
+    size_t constant = (size_t) chunk->code[offset + 1]
+        | (size_t) chunk->code[offset + 2] << 8
+        | (size_t) chunk->code[offset + 3] << 16;
+    printf("%-16s %4zu '", name, constant);
+    value_print(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 4;
+}
+
+static size_t bytes_operation(const char* name, chunk_t* chunk, size_t offset) {
+    printf("%-16s %4d %4d\n", name, chunk->code[offset + 1], chunk->code[offset + 2]);
+    return offset + 3;
+}
+
+static size_t byte_const_operation(const char* name, chunk_t* chunk, size_t offset) {
+    size_t constant = (size_t) chunk->code[offset + 2];
+    printf("%-16s %4d %4zu '", name, chunk->code[offset + 1], constant);
+    value_print(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+}
+
+static size_t jump_operation(const char* name, int sign, chunk_t* chunk, size_t offset) {
+    size_t jump = (size_t) chunk->code[offset + 1] | (size_t) chunk->code[offset + 2] << 8;
+    printf("%-16s %4zu -> %zu\n", name, offset, offset + 3 + sign * jump);
+    return offset + 3;
+}
+
+static size_t for_operation(const char* name, chunk_t* chunk, size_t offset) {
+    byte_t* code = &chunk->code[offset];
+    size_t jump = (size_t) code[4] | (size_t) code[5] << 8;
+    printf("%-16s %4d %4d %4d %4zu -> %zu\n", name, code[1], code[2], code[3], offset, offset + 6 - jump);
+    return offset + 6;
+}
+
 extern void disassemble_chunk(chunk_t* chunk, const char* name) {
     printf("== %s ==\n", name);
 
@@ -43,68 +139,59 @@ extern void disassemble_chunk(chunk_t* chunk, const char* name) {
     }
 }
 
+extern const char* operation_name(byte_t operation) {
+    if (operation >= sizeof(names) / sizeof(names[0]) || names[operation] == NULL) {
+        return NULL;
+    }
+    return names[operation];
+}
+
 extern size_t disassemble_operation(chunk_t* chunk, size_t offset) {
     printf("%04zu ", offset);
-    if (offset && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    size_t line = chunk_line(chunk, offset);
+    if (offset && line == chunk_line(chunk, offset - 1)) {
         printf("   | ");
     } else {
-        printf("%4zu ", chunk->lines[offset]);
+        printf("%4zu ", line);
     }
 
     operation_t operation = (operation_t) chunk->code[offset];
+    const char* name = operation_name(operation);
     switch (operation) {
         case OP_CONSTANT:
-            return const_operation("OP_CONSTANT", chunk, offset);
-        case OP_NULL:
-            return simple_operation("OP_NULL", offset);
-        case OP_TRUE:
-            return simple_operation("OP_TRUE", offset);
-        case OP_FALSE:
-            return simple_operation("OP_FALSE", offset);
-        case OP_NOT:
-            return simple_operation("OP_NOT", offset);
-        case OP_NEGATE:
-            return simple_operation("OP_NEGATE", offset);
-        case OP_EQUAL:
-            return simple_operation("OP_EQUAL", offset);
-        case OP_NOT_EQUAL:
-            return simple_operation("OP_NOT_EQUAL", offset);
-        case OP_LESS:
-            return simple_operation("OP_LESS", offset);
-        case OP_LESS_EQUAL:
-            return simple_operation("OP_LESS_EQUAL", offset);
-        case OP_GREATER:
-            return simple_operation("OP_GREATER", offset);
-        case OP_GREATER_EQUAL:
-            return simple_operation("OP_GREATER_EQUAL", offset);
-        case OP_AND:
-            return simple_operation("OP_AND", offset);
-        case OP_OR:
-            return simple_operation("OP_OR", offset);
-        case OP_ADD:
-            return simple_operation("OP_ADD", offset);
-        case OP_SUBTRACT:
-            return simple_operation("OP_SUBTRACT", offset);
-        case OP_MULTIPLY:
-            return simple_operation("OP_MULTIPLY", offset);
-        case OP_DIVIDE:
-            return simple_operation("OP_DIVIDE", offset);
-        case OP_MODULO:
-            return simple_operation("OP_MODULO", offset);
-        case OP_RETURN:
-            return simple_operation("OP_RETURN", offset);
-        case OP_PRINT:
-            return simple_operation("OP_PRINT", offset);
-        case OP_POP:
-            return simple_operation("OP_POP", offset);
         case OP_DEFINE_GLOBAL:
-            return simple_operation("OP_DEFINE_GLOBAL", offset);
         case OP_GET_GLOBAL:
-            return simple_operation("OP_GET_GLOBAL", offset);
         case OP_SET_GLOBAL:
-            return simple_operation("OP_SET_GLOBAL", offset);
+            return const_operation(name, chunk, offset);
+        case OP_CONSTANT_LONG:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_GET_GLOBAL_LONG:
+        case OP_SET_GLOBAL_LONG:
+            return const_long_operation(name, chunk, offset);
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            return byte_operation(name, chunk, offset);
+        case OP_ADD_LOCALS:
+            return bytes_operation(name, chunk, offset);
+        case OP_LESS_LOCAL_CONSTANT:
+        case OP_ADD_LOCAL_CONSTANT:
+        case OP_ADD_GLOBAL_CONSTANT:
+            return byte_const_operation(name, chunk, offset);
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+            return jump_operation(name, 1, chunk, offset);
+        case OP_LOOP:
+            return jump_operation(name, -1, chunk, offset);
+        case OP_FOR_LESS_CONSTANT:
+        case OP_FOR_LESS_LOCAL:
+            return for_operation(name, chunk, offset);
         default:
-            printf("Unknown operation %d\n", operation);
-            return offset + 1;
+            if (name == NULL) {
+                printf("Unknown operation %d\n", operation);
+                return offset + 1;
+            }
+            return simple_operation(name, offset);
     }
 }
@@ -0,0 +1,183 @@
+/* GC - Mark-and-sweep garbage collector
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "gc.h"
+#include "object.h"
+#include "pool.h"
+
+//#define DEBUG_STRESS_GC
+//#define DEBUG_LOG_GC
+
+#define BASE_THRESHOLD (1024 * 1024)
+#define GROW_FACTOR 2
+
+typedef struct heap heap_t;
+
+struct heap {
+    object_t* objects;
+    size_t allocated;
+    size_t threshold;
+    gc_stats_t stats;
+};
+
+static _Thread_local heap_t heap = { .threshold = BASE_THRESHOLD };
+
+static uint64_t clock_time(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000u + (uint64_t) time.tv_nsec;
+}
+
+static size_t sweep(void) {
+    size_t freed = 0;
+    object_t** object = &heap.objects;
+    while (*object != NULL) {
+        if ((*object)->marked || (*object)->pins > 0) {
+            (*object)->marked = false;
+            object = &(*object)->next;
+        } else {
+            object_t* garbage = *object;
+            *object = garbage->next;
+            freed += object_size(garbage);
+            object_free(garbage);
+        }
+    }
+    return freed;
+}
+
+extern void gc_track(object_t* object) {
+    object->marked = false;
+    object->pins = 0;
+    object->next = heap.objects;
+    heap.objects = object;
+    heap.allocated += object_size(object);
+}
+
+extern bool gc_pending(void) {
+#ifdef DEBUG_STRESS_GC
+    return true;
+#else
+    return heap.allocated > heap.threshold;
+#endif
+}
+
+extern void gc_collect(gc_roots_t roots, void* data) {
+    uint64_t start = clock_time();
+
+    roots(data);
+    string_sweep();
+    size_t freed = sweep();
+
+    heap.allocated -= freed;
+    heap.threshold = heap.allocated * GROW_FACTOR;
+    if (heap.threshold < BASE_THRESHOLD) {
+        heap.threshold = BASE_THRESHOLD;
+    }
+
+    uint64_t pause = clock_time() - start;
+    ++heap.stats.collections;
+    heap.stats.freed_bytes += freed;
+    heap.stats.last_freed_bytes = freed;
+    heap.stats.pause_time += pause;
+    heap.stats.last_pause_time = pause;
+
+#ifdef DEBUG_LOG_GC
+    printf("-- gc: freed %zu bytes, %zu live, next at %zu (%" PRIu64 " ns)\n",
+        freed, heap.allocated, heap.threshold, pause);
+#endif
+}
+
+extern const void* gc_heap(void) {
+    return &heap;
+}
+
+extern void gc_free(void) {
+    // Functions unpin their constants when freed, so they must go while
+    // those are still alive.
+    object_t** link = &heap.objects;
+    while (*link != NULL) {
+        object_t* object = *link;
+        if (object->type == OBJ_FUNCTION) {
+            *link = object->next;
+            object_free(object);
+        } else {
+            link = &object->next;
+        }
+    }
+
+    // Every string goes, pinned or not, so the intern table must forget
+    // them all before it can point at freed memory.
+    string_free_all();
+    while (heap.objects != NULL) {
+        object_t* object = heap.objects;
+        heap.objects = object->next;
+        object_free(object);
+    }
+    pool_release();
+    heap.allocated = 0;
+    heap.threshold = BASE_THRESHOLD;
+}
+
+// Pinned objects are never freed, so they are not marked either. That
+// keeps a collection from writing to objects shared with other threads.
+extern void gc_mark_object(object_t* object) {
+    if (object == NULL || object->marked || object->pins > 0) return;
+    object->marked = true;
+
+    if (object->type == OBJ_FUNCTION) {
+        function_t* function = (function_t*) object;
+        gc_mark_object(&function->name->object);
+        for (size_t i = 0; i < function->body->constants.length; ++i) {
+            gc_mark_value(function->constants[i]);
+        }
+    }
+}
+
+extern void gc_pin(value_t value) {
+    if (IS_OBJECT(value)) {
+        ++AS_OBJECT(value)->pins;
+    }
+}
+
+extern void gc_unpin(value_t value) {
+    if (IS_OBJECT(value)) {
+        --AS_OBJECT(value)->pins;
+    }
+}
+
+extern void gc_mark_value(value_t value) {
+    if (IS_OBJECT(value)) {
+        gc_mark_object(AS_OBJECT(value));
+    }
+}
+
+extern void gc_mark_varray(varray_t* array) {
+    for (size_t i = 0; i < array->length; ++i) {
+        gc_mark_value(array->values[i]);
+    }
+}
+
+extern gc_stats_t gc_stats(void) {
+    gc_stats_t stats = heap.stats;
+    stats.live_bytes = heap.allocated;
+    return stats;
+}
@@ -28,26 +28,27 @@
 typedef struct keyword keyword_t;
 struct keyword {
     const char* value;
+    size_t size;
     token_type_t type;
 };
 
-static keyword_t keywords[KWS_NUM] = {
-    { "true", TOKEN_TRUE },
-    { "false", TOKEN_FALSE },
-    { "null", TOKEN_NULL },
-    { "if", TOKEN_IF },
-    { "else", TOKEN_ELSE },
-    { "var", TOKEN_VAR },
-    { "for", TOKEN_FOR },
-    { "while", TOKEN_WHILE },
-    { "return", TOKEN_RETURN },
-    { "function", TOKEN_FUNC },
-    { "class", TOKEN_CLASS },
-    { "super", TOKEN_SUPER },
-    { "this", TOKEN_THIS },
-    { "new", TOKEN_NEW },
-    { "program", TOKEN_PROGRAM },
-    { "print", TOKEN_PRINT }
+static const keyword_t keywords[KWS_NUM] = {
+    { "true", 4, TOKEN_TRUE },
+    { "false", 5, TOKEN_FALSE },
+    { "null", 4, TOKEN_NULL },
+    { "if", 2, TOKEN_IF },
+    { "else", 4, TOKEN_ELSE },
+    { "var", 3, TOKEN_VAR },
+    { "for", 3, TOKEN_FOR },
+    { "while", 5, TOKEN_WHILE },
+    { "return", 6, TOKEN_RETURN },
+    { "function", 8, TOKEN_FUNC },
+    { "class", 5, TOKEN_CLASS },
+    { "super", 5, TOKEN_SUPER },
+    { "this", 4, TOKEN_THIS },
+    { "new", 3, TOKEN_NEW },
+    { "program", 7, TOKEN_PROGRAM },
+    { "print", 5, TOKEN_PRINT }
 };
 
 static inline bool is_alpha(char c) {
@@ -102,7 +103,7 @@ static inline token_t assert_token(lexer_t* lexer, char expected, token_type_t t
 static token_type_t id_token(lexer_t* lexer) {
     size_t size = (size_t)(lexer->current - lexer->start);
     for (size_t i = 0; i < KWS_NUM; ++i) {
-        if (!memcmp(lexer->start, keywords[i].value, size)) {
+        if (keywords[i].size == size && !memcmp(lexer->start, keywords[i].value, size)) {
             return keywords[i].type;
         }
     }
@@ -123,7 +124,7 @@ static void skip_whitespace(lexer_t* lexer) {
                 break;
             case '/': {
                 if (lexer->current[1] != '/') return;
-                while (*lexer->current != '\n') {
+                while (*lexer->current != '\n' && !at_end(lexer)) {
                     advance(lexer);
                 }
                 break;
@@ -19,51 +19,174 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "chunk.h"
 #include "parser.h"
 #include "vm.h"
+#include "gc.h"
+#include "serial.h"
 
-char* read_file(const char* path) {
-    FILE* file = fopen(path, "r+");
-    if (file == NULL) {
+typedef struct source source_t;
+
+struct source {
+    char* target;
+    size_t size;
+    size_t mapped;
+};
+
+static void read_stream(source_t* source, int descriptor, const char* path) {
+    size_t size = 4096;
+    source->size = source->mapped = 0;
+    source->target = (char*) malloc(size);
+
+    while (source->target != NULL) {
+        if (source->size + 1 == size) {
+            char* target = (char*) realloc(source->target, size *= 2);
+            if (target == NULL) break;
+            source->target = target;
+        }
+
+        ssize_t bytes = read(descriptor, source->target + source->size, size - source->size - 1);
+        if (bytes < 0) {
+            fprintf(stderr, "Could not read file \"%s\".\n", path);
+            exit(74);
+        }
+        if (bytes == 0) {
+            source->target[source->size] = '\0';
+            return;
+        }
+        source->size += (size_t) bytes;
+    }
+
+    fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+    exit(1);
+}
+
+static bool map_file(source_t* source, int descriptor, size_t size) {
+    // The lexer stops at '\0'. mmap zero-fills the tail of the last page,
+    // so a terminator is already there unless the file ends on a page
+    // boundary; then an anonymous zero page is reserved right after it.
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t mapped = (size / page + 1) * page;
+
+    char* target = mmap(NULL, mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (target == MAP_FAILED) {
+        return false;
+    }
+
+    if (size > 0 && mmap(target, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, descriptor, 0) == MAP_FAILED) {
+        munmap(target, mapped);
+        return false;
+    }
+
+    source->target = target;
+    source->size = size;
+    source->mapped = mapped;
+    return true;
+}
+
+static void read_file(source_t* source, const char* path) {
+    int descriptor = strcmp(path, "-") ? open(path, O_RDONLY) : STDIN_FILENO;
+    if (descriptor == -1) {
         fprintf(stderr, "Could not open file \"%s\".\n", path);
         exit(74);
     }
 
-    fseek(file, 0L, SEEK_END);
-    size_t file_size = ftell(file);
-    rewind(file);
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || !S_ISREG(info.st_mode)
+        || !map_file(source, descriptor, (size_t) info.st_size)) {
+        read_stream(source, descriptor, path);
+    }
 
-    char* buffer = (char*) malloc(file_size + 1);
-    if (buffer == NULL) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(1);
+    if (descriptor != STDIN_FILENO) {
+        close(descriptor);
+    }
+}
+
+static void free_file(source_t* source) {
+    if (source->mapped) {
+        munmap(source->target, source->mapped);
+    } else {
+        free(source->target);
     }
-    size_t bytes = fread(buffer, sizeof(char), file_size, file);
-    if (bytes < file_size) {
-        fprintf(stderr, "Could not read file \"%s\".\n", path);
+}
+
+static char* cache_path(const char* path) {
+    size_t size = strlen(path);
+    char* buffer = (char*) malloc(size + 2);
+    if (buffer == NULL) {
+        fprintf(stderr, "Not enough memory.\n");
         exit(1);
     }
-    buffer[bytes] = '\0';
 
-    fclose(file);
+    memcpy(buffer, path, size);
+    buffer[size] = 'c';
+    buffer[size + 1] = '\0';
     return buffer;
 }
 
 int main(int argc, char** argv) {
+    bool optimize = false;
+    vm_engine_t engine = VM_STACK;
+    for (; argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0'; --argc, ++argv) {
+        if (!strcmp(argv[1], "-O")) {
+            optimize = true;
+        } else if (!strcmp(argv[1], "-r")) {
+            engine = VM_REGISTERS;
+        } else {
+            argc = 0;
+            break;
+        }
+    }
+
+    if (argc == 0 || argc > 2) {
+        fprintf(stderr, "Usage: woden [-O] [-r] [path]\n");
+        return 64;
+    }
+
     chunk_t chunk;
-    char* code = read_file(argv[1]);
+    source_t source;
+    const char* path = argc == 2 ? argv[1] : "-";
+    read_file(&source, path);
+
+    // Piped scripts have nowhere to keep a cache, and optimized
+    // builds must not share one with plain builds.
+    char* cache = strcmp(path, "-") ? cache_path(path) : NULL;
+    uint64_t hash = serial_hash(source.target, source.size, optimize);
 
     chunk_init(&chunk);
-    if (!parser_parse(&chunk, code)) {
-        return 0;
+    if (cache == NULL || !serial_load(&chunk, cache, hash)) {
+        chunk_free(&chunk);
+        chunk_init(&chunk);
+        if (!parser_parse(&chunk, source.target, optimize)) {
+            return 0;
+        }
+        if (cache != NULL) {
+            serial_save(&chunk, cache, hash);
+        }
     }
+    free(cache);
+    free_file(&source);
 
-    if (vm_run(&chunk) != VM_SUCCESS) {
+    vm_t* vm = vm_create(engine);
+    vm_result_t result = vm_execute(vm, &chunk);
+    // Timings of -r runs must not be mistaken for timings of the
+    // register engine.
+    if (vm_stats(vm).fallbacks > 0) {
+        fprintf(stderr, "Register engine cannot run this script; it ran on the stack engine.\n");
+    }
+    vm_destroy(vm);
+    if (result != VM_SUCCESS) {
         return 0;
     }
 
     chunk_free(&chunk);
+    gc_free();
     return 0;
 }
@@ -17,11 +17,16 @@
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "object.h"
-#include "array.h"
+#include "table.h"
+#include "gc.h"
+#include "pool.h"
+
+static _Thread_local table_t strings;
 
 static uint32_t string_hash(const char* key, size_t size) {
     uint32_t hash = 2166136261u;
@@ -33,33 +38,130 @@ static uint32_t string_hash(const char* key, size_t size) {
 }
 
 static object_t* object_alloc(size_t size, object_type_t type) {
-    object_t* object = (object_t*)malloc(size);
+    object_t* object = (object_t*) pool_alloc(size);
     object->type = type;
     return object;
 }
 
-extern string_t* string_alloc(char* chars, size_t size, uint32_t hash) {
-    string_t* string = (string_t*)object_alloc(sizeof(string_t), OBJ_STRING);
+static inline string_t* string_alloc(size_t size) {
+    string_t* string = (string_t*) object_alloc(sizeof(string_t) + size + 1, OBJ_STRING);
     string->size = size;
-    string->target = chars;
-    string->hash = hash;
+    string->target[size] = '\0';
     return string;
 }
 
-extern string_t* string_make(char* chars, size_t size) {
-    uint32_t hash = string_hash(chars, size);
-    return string_alloc(chars, size, hash);
+static string_t* string_intern(string_t* string, uint32_t hash) {
+    string->hash = hash;
+    table_set(&strings, string, NULL_VAL);
+    gc_track(&string->object);
+    return string;
 }
 
 extern string_t* string_copy(const char* source, size_t size) {
-    char* target = array_alloc(char, size + 1);
-    memcpy(target, source, size);
-    target[size] = '\0';
-    return string_make(target, size);
+    uint32_t hash = string_hash(source, size);
+    string_t* interned = table_find_string(&strings, source, size, hash);
+    if (interned != NULL) {
+        return interned;
+    }
+
+    string_t* string = string_alloc(size);
+    memcpy(string->target, source, size);
+    return string_intern(string, hash);
+}
+
+extern string_t* string_concat(string_t* x, string_t* y) {
+    string_t* string = string_alloc(x->size + y->size);
+    memcpy(string->target, x->target, x->size);
+    memcpy(string->target + x->size, y->target, y->size);
+
+    uint32_t hash = string_hash(string->target, string->size);
+    string_t* interned = table_find_string(&strings, string->target, string->size, hash);
+    if (interned != NULL) {
+        pool_free(string, object_size(&string->object));
+        return interned;
+    }
+    return string_intern(string, hash);
+}
+
+extern function_t* function_new(string_t* name) {
+    function_t* function = (function_t*) object_alloc(sizeof(function_t), OBJ_FUNCTION);
+    function->arity = 0;
+    function->name = name;
+    chunk_init(&function->chunk);
+    function->body = &function->chunk;
+    function->constants = NULL;
+    function->caches = NULL;
+    function->source = NULL;
+    function->heap = gc_heap();
+
+    gc_track(&function->object);
+    gc_pin(OBJECT_VAL(name));
+    return function;
+}
+
+extern function_t* function_copy(function_t* source) {
+    function_t* function = (function_t*) object_alloc(sizeof(function_t), OBJ_FUNCTION);
+    varray_t* constants = &source->body->constants;
+    function->arity = source->arity;
+    function->name = string_copy(source->name->target, source->name->size);
+    function->body = source->body;
+    function->constants = malloc((constants->length + 1) * sizeof(value_t));
+    function->caches = calloc(constants->length + 1, sizeof(table_cache_t));
+    function->source = source;
+    function->heap = gc_heap();
+
+    for (size_t i = 0; i < constants->length; ++i) {
+        value_t value = constants->values[i];
+        if (IS_STRING(value)) {
+            value = OBJECT_VAL(string_copy(AS_CSTRING(value), AS_STRING(value)->size));
+        }
+        function->constants[i] = value;
+    }
+
+    gc_track(&function->object);
+    return function;
+}
+
+// Called once the chunk is complete: the constant pool no longer moves
+// and its length is final.
+extern void function_prepare(function_t* function) {
+    function->constants = function->chunk.constants.values;
+    function->caches = calloc(function->chunk.constants.length + 1, sizeof(table_cache_t));
 }
 
 extern void object_print(value_t value) {
     switch (OBJECT_TYPE(value)) {
         case OBJ_STRING: printf("%s", AS_CSTRING(value)); break;
+        case OBJ_FUNCTION: printf("<function %s>", AS_FUNCTION(value)->name->target); break;
+    }
+}
+
+extern size_t object_size(object_t* object) {
+    switch (object->type) {
+        case OBJ_STRING: return sizeof(string_t) + ((string_t*)object)->size + 1;
+        case OBJ_FUNCTION: return sizeof(function_t);
+        default: return 0;
     }
 }
+
+extern void object_free(object_t* object) {
+    if (object->type == OBJ_FUNCTION) {
+        function_t* function = (function_t*) object;
+        if (function->source == NULL) {
+            chunk_free(&function->chunk);
+            gc_unpin(OBJECT_VAL(function->name));
+        } else {
+            free(function->constants);
+        }
+        free(function->caches);
+    }
+    pool_free(object, object_size(object));
+}
+
+extern void string_sweep(void) {
+    table_sweep(&strings);
+}
+
+extern void string_free_all(void) {
+    table_free(&strings);
+}
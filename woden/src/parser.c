@@ -18,19 +18,50 @@
  */
 
 #include <stdio.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "parser.h"
 #include "lexer.h"
 #include "object.h"
 
+#define LOCALS_SIZE 256
+
 typedef struct parser parser_t;
+typedef struct local local_t;
 typedef enum precendense precendense_t;
 typedef struct parse_rule parse_rule_t;
+typedef enum emitted emitted_t;
 typedef void (*parse_t)(parser_t*, bool);
 
+struct local {
+    token_t name;
+    int depth;
+};
+
+// What the expression ending at the last emitted instruction is, as far
+// as the optimizer cares, and where its code starts. Any other emit
+// resets it to EMITTED_OTHER.
+enum emitted {
+    EMITTED_OTHER,
+    EMITTED_CONSTANT,
+    EMITTED_LOCAL,
+    EMITTED_COMPARISON
+};
+
 struct parser {
     chunk_t* target;
+    function_t* function;
+    bool optimize;
+    emitted_t emitted;
+    size_t emitted_at;
+    size_t call_at;
+    value_t value;
+    size_t start;
+    local_t locals[LOCALS_SIZE];
+    size_t locals_count;
+    int scope_depth;
     bool error;
     bool panic;
     lexer_t lexer;
@@ -62,13 +93,19 @@ static void variable(parser_t*, bool);
 static void expression(parser_t*, bool);
 static void grouping(parser_t*, bool);
 static void binary(parser_t*, bool);
+static void call(parser_t*, bool);
+static void logic_and(parser_t*, bool);
+static void logic_or(parser_t*, bool);
 static void unary(parser_t*, bool);
 static void string(parser_t*, bool);
 static void number(parser_t*, bool);
 static void literal(parser_t*, bool);
+static void block(parser_t*);
+static void statement(parser_t*);
+static void var_declaration(parser_t*);
 
-parse_rule_t rules[] = {
-    [TOKEN_LEFT_PAREN] = { grouping, NULL, PREC_NONE },
+static const parse_rule_t rules[] = {
+    [TOKEN_LEFT_PAREN] = { grouping, call, PREC_CALL },
     [TOKEN_RIGHT_PAREN] = { NULL, NULL, PREC_NONE },
     [TOKEN_LEFT_BRACE] = { NULL, NULL, PREC_NONE },
     [TOKEN_RIGHT_BRACE] = { NULL, NULL, PREC_NONE },
@@ -87,13 +124,13 @@ parse_rule_t rules[] = {
     [TOKEN_EQUAL] = { NULL, NULL, PREC_NONE },
     [TOKEN_EQUAL_EQUAL] = { NULL, binary, PREC_EQUALITY },
     [TOKEN_GREATER] = { NULL, binary, PREC_COMPARISON },
-    [TOKEN_GREATER_EQUAL] = { binary, NULL, PREC_COMPARISON },
+    [TOKEN_GREATER_EQUAL] = { NULL, binary, PREC_COMPARISON },
     [TOKEN_LESS] = { NULL, binary, PREC_COMPARISON },
     [TOKEN_LESS_EQUAL] = { NULL, binary, PREC_COMPARISON },
     [TOKEN_IDENTIFIER] = { variable, NULL, PREC_NONE },
     [TOKEN_STRING] = { string, NULL, PREC_NONE },
     [TOKEN_NUMBER] = { number, NULL, PREC_NONE },
-    [TOKEN_AND] = { NULL, NULL, PREC_NONE },
+    [TOKEN_AND] = { NULL, logic_and, PREC_AND },
     [TOKEN_CLASS] = { NULL, NULL, PREC_NONE },
     [TOKEN_ELSE] = { NULL, NULL, PREC_NONE },
     [TOKEN_FALSE] = { literal, NULL, PREC_NONE },
@@ -101,7 +138,7 @@ parse_rule_t rules[] = {
     [TOKEN_FUNC] = { NULL, NULL, PREC_NONE },
     [TOKEN_IF] = { NULL, NULL, PREC_NONE },
     [TOKEN_NULL] = { literal, NULL, PREC_NONE },
-    [TOKEN_OR] = { NULL, NULL, PREC_NONE },
+    [TOKEN_OR] = { NULL, logic_or, PREC_OR },
     [TOKEN_PRINT] = { NULL, NULL, PREC_NONE },
     [TOKEN_RETURN] = { NULL, NULL, PREC_NONE },
     [TOKEN_SUPER] = { NULL, NULL, PREC_NONE },
@@ -160,6 +197,18 @@ static void consume(parser_t* parser, token_type_t type, const char* message) {
 
 static inline void emit_byte(parser_t* parser, byte_t byte) {
     chunk_write(parser->target, byte, parser->previous.line);
+    parser->emitted = EMITTED_OTHER;
+}
+
+static inline void emitted(parser_t* parser, emitted_t emitted, size_t start) {
+    if (parser->optimize) {
+        parser->emitted = emitted;
+        parser->emitted_at = start;
+    }
+}
+
+static inline bool is_emitted(parser_t* parser, emitted_t emitted, size_t start) {
+    return parser->emitted == emitted && parser->emitted_at == start;
 }
 
 static inline void emit_return(parser_t* parser) {
@@ -171,6 +220,34 @@ static void emit_bytes(parser_t* parser, byte_t byte1, byte_t byte2) {
     emit_byte(parser, byte2);
 }
 
+// Emits a forward jump whose offset is filled in by patch_jump() once
+// the code it skips has been compiled. Returns where the offset goes.
+static size_t emit_jump(parser_t* parser, operation_t operation) {
+    emit_byte(parser, operation);
+    emit_bytes(parser, 0xff, 0xff);
+    return parser->target->length - 2;
+}
+
+static void patch_jump(parser_t* parser, size_t at) {
+    size_t jump = parser->target->length - at - 2;
+    if (jump > JUMP_MAX) {
+        error(parser, "Too much code to jump over.");
+    }
+
+    parser->target->code[at] = (byte_t)(jump & 0xff);
+    parser->target->code[at + 1] = (byte_t)((jump >> 8) & 0xff);
+}
+
+static void emit_loop(parser_t* parser, size_t start) {
+    emit_byte(parser, OP_LOOP);
+    size_t jump = parser->target->length - start + 2;
+    if (jump > JUMP_MAX) {
+        error(parser, "Loop body too large.");
+    }
+
+    emit_bytes(parser, (byte_t)(jump & 0xff), (byte_t)((jump >> 8) & 0xff));
+}
+
 static bool match(parser_t* parser, token_type_t type) {
     if (parser->current.type != type) {
         return false;
@@ -182,6 +259,7 @@ static bool match(parser_t* parser, token_type_t type) {
 
 static void end_parsing(parser_t* parser) {
     emit_return(parser);
+    parser->target->depth = chunk_depth(parser->target);
 
 #ifdef DEBUG_PRINT_CODE
     if (!parser.error) {
@@ -190,24 +268,117 @@ static void end_parsing(parser_t* parser) {
 #endif
 }
 
-static byte_t make_constant(parser_t* parser, value_t value) {
-    byte_t byte = chunk_value(parser->target, value);
-    if (byte == UINT8_MAX) {
+static size_t make_constant(parser_t* parser, value_t value) {
+    size_t index = chunk_value(parser->target, value);
+    if (index > CONSTANTS_MAX) {
         error(parser, "Too many constants in one chunk.");
         return 0;
     }
-    return byte;
+    return index;
+}
+
+static void emit_indexed(parser_t* parser, operation_t operation, operation_t long_operation, size_t index) {
+    if (index <= UINT8_MAX) {
+        return emit_bytes(parser, operation, (byte_t) index);
+    }
+
+    emit_byte(parser, long_operation);
+    emit_byte(parser, (byte_t)(index & 0xff));
+    emit_byte(parser, (byte_t)((index >> 8) & 0xff));
+    emit_byte(parser, (byte_t)((index >> 16) & 0xff));
 }
 
 static inline void emit_constant(parser_t* parser, value_t value) {
-    emit_bytes(parser, OP_CONSTANT, make_constant(parser, value));
+    size_t start = parser->target->length;
+    emit_indexed(parser, OP_CONSTANT, OP_CONSTANT_LONG, make_constant(parser, value));
+    emitted(parser, EMITTED_CONSTANT, start);
+    parser->value = value;
+}
+
+static void emit_value(parser_t* parser, value_t value) {
+    size_t start = parser->target->length;
+    if (IS_NULL(value)) {
+        emit_byte(parser, OP_NULL);
+    } else if (IS_BOOL(value)) {
+        emit_byte(parser, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else {
+        return emit_constant(parser, value);
+    }
+    emitted(parser, EMITTED_CONSTANT, start);
+    parser->value = value;
+}
+
+static inline bool is_falsey(value_t value) {
+    return IS_NULL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+// Evaluates an operator on constant operands the way the VM would.
+// Returns false when the VM would raise an error, which is left to it.
+static bool fold_binary(token_type_t type, value_t x, value_t y, value_t* result) {
+    switch (type) {
+        case TOKEN_EQUAL_EQUAL: *result = BOOL_VAL(value_equal(x, y)); return true;
+        case TOKEN_BANG_EQUAL: *result = BOOL_VAL(!value_equal(x, y)); return true;
+        default: break;
+    }
+
+    if (type == TOKEN_PLUS && IS_STRING(x) && IS_STRING(y)) {
+        *result = OBJECT_VAL(string_concat(AS_STRING(x), AS_STRING(y)));
+        return true;
+    }
+
+    if (!IS_NUMBER(x) || !IS_NUMBER(y)) {
+        return false;
+    }
+
+    double a = AS_NUMBER(x);
+    double b = AS_NUMBER(y);
+    switch (type) {
+        case TOKEN_GREATER: *result = BOOL_VAL(a > b); return true;
+        case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(a < b)); return true;
+        case TOKEN_LESS: *result = BOOL_VAL(a < b); return true;
+        case TOKEN_LESS_EQUAL: *result = BOOL_VAL(!(a > b)); return true;
+        case TOKEN_PLUS: *result = NUMBER_VAL(a + b); return true;
+        case TOKEN_MINUS: *result = NUMBER_VAL(a - b); return true;
+        case TOKEN_STAR: *result = NUMBER_VAL(a * b); return true;
+        case TOKEN_SLASH: *result = NUMBER_VAL(a / b); return true;
+        case TOKEN_PERCENT: *result = NUMBER_VAL(fmod(a, b)); return true;
+        default: return false;
+    }
 }
 
-static inline parse_rule_t* get_rule(token_type_t type) {
+static bool fold_unary(token_type_t type, value_t x, value_t* result) {
+    switch (type) {
+        case TOKEN_BANG:
+            *result = BOOL_VAL(is_falsey(x));
+            return true;
+        case TOKEN_MINUS:
+            if (!IS_NUMBER(x)) return false;
+            *result = NUMBER_VAL(-AS_NUMBER(x));
+            return true;
+        default:
+            return false;
+    }
+}
+
+// The VM defines x >= y as !(x < y) and x <= y as !(x > y),
+// so every comparison followed by OP_NOT is another comparison.
+static operation_t negate_comparison(operation_t operation) {
+    switch (operation) {
+        case OP_EQUAL: return OP_NOT_EQUAL;
+        case OP_NOT_EQUAL: return OP_EQUAL;
+        case OP_LESS: return OP_GREATER_EQUAL;
+        case OP_GREATER_EQUAL: return OP_LESS;
+        case OP_GREATER: return OP_LESS_EQUAL;
+        default: return OP_GREATER;
+    }
+}
+
+static inline const parse_rule_t* get_rule(token_type_t type) {
     return &rules[type];
 }
 
 static void parse_precedence(parser_t* parser, precendense_t precedence) {
+    size_t start = parser->target->length;
     advance(parser);
     parse_t prefix_rule = get_rule(parser->previous.type)->prefix;
     if (prefix_rule == NULL) {
@@ -219,6 +390,7 @@ static void parse_precedence(parser_t* parser, precendense_t precedence) {
     while (precedence <= get_rule(parser->current.type)->precendense) {
         advance(parser);
         parse_t infix_rule = get_rule(parser->previous.type)->infix;
+        parser->start = start;
         infix_rule(parser, can_assign);
     }
 
@@ -233,6 +405,7 @@ static void synchronize(parser_t* parser) {
     while (parser->current.type != TOKEN_EOF) {
         if (parser->previous.type == TOKEN_SEMICOLON) return;
         switch (parser->current.type) {
+            case TOKEN_FUNC:
             case TOKEN_VAR:
             case TOKEN_FOR:
             case TOKEN_IF:
@@ -247,17 +420,151 @@ static void synchronize(parser_t* parser) {
     }
 }
 
-static inline byte_t id_constant(parser_t* parser, token_t* name) {
+static inline size_t id_constant(parser_t* parser, token_t* name) {
     return make_constant(parser, OBJECT_VAL(string_copy(name->start, name->size)));
 }
 
-static byte_t parse_variable(parser_t* parser, const char* error) {
+static inline bool same_name(token_t* x, token_t* y) {
+    return x->size == y->size && !memcmp(x->start, y->start, x->size);
+}
+
+static void begin_scope(parser_t* parser) {
+    ++parser->scope_depth;
+}
+
+static void end_scope(parser_t* parser) {
+    --parser->scope_depth;
+
+    while (parser->locals_count > 0
+        && parser->locals[parser->locals_count - 1].depth > parser->scope_depth) {
+        emit_byte(parser, OP_POP);
+        --parser->locals_count;
+    }
+}
+
+static int resolve_local(parser_t* parser, token_t* name) {
+    for (int i = (int) parser->locals_count - 1; i >= 0; --i) {
+        local_t* local = &parser->locals[i];
+        if (same_name(name, &local->name)) {
+            if (local->depth == -1) {
+                error(parser, "Can't read local variable in its own initializer.");
+            }
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void add_local(parser_t* parser, token_t name) {
+    if (parser->locals_count == LOCALS_SIZE) {
+        return error(parser, "Too many local variables in one chunk.");
+    }
+
+    local_t* local = &parser->locals[parser->locals_count++];
+    local->name = name;
+    local->depth = -1;
+}
+
+static void declare_variable(parser_t* parser) {
+    token_t* name = &parser->previous;
+    for (int i = (int) parser->locals_count - 1; i >= 0; --i) {
+        local_t* local = &parser->locals[i];
+        if (local->depth != -1 && local->depth < parser->scope_depth) {
+            break;
+        }
+
+        if (same_name(name, &local->name)) {
+            return error(parser, "Already a variable with this name in this scope.");
+        }
+    }
+    add_local(parser, *name);
+}
+
+static size_t parse_variable(parser_t* parser, const char* error) {
     consume(parser, TOKEN_IDENTIFIER, error);
+    if (parser->scope_depth > 0) {
+        declare_variable(parser);
+        return 0;
+    }
     return id_constant(parser, &parser->previous);
 }
 
-static void define_variable(parser_t* parser, byte_t global) {
-    emit_bytes(parser, OP_DEFINE_GLOBAL, global);
+static void define_variable(parser_t* parser, size_t global) {
+    if (parser->scope_depth > 0) {
+        parser->locals[parser->locals_count - 1].depth = parser->scope_depth;
+        return;
+    }
+    emit_indexed(parser, OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, global);
+}
+
+// Superinstructions. Each replaces the code of a whole expression or
+// statement, so no jump can land between the fused instructions.
+static bool fuse_binary(parser_t* parser, token_type_t type, size_t left, size_t right) {
+    byte_t* code = parser->target->code;
+    operation_t operation;
+
+    if (type == TOKEN_PLUS && is_emitted(parser, EMITTED_LOCAL, right)) {
+        operation = OP_ADD_LOCALS;
+    } else if (type == TOKEN_LESS && is_emitted(parser, EMITTED_CONSTANT, right) && code[right] == OP_CONSTANT) {
+        operation = OP_LESS_LOCAL_CONSTANT;
+    } else {
+        return false;
+    }
+
+    byte_t x = code[left + 1];
+    byte_t y = code[right + 1];
+    chunk_truncate(parser->target, left);
+    emit_bytes(parser, operation, x);
+    emit_byte(parser, y);
+    return true;
+}
+
+// Matches 'x = x + k;' where k is a short constant, which compiles to
+// GET x, CONSTANT k, ADD, SET x before the statement's OP_POP.
+static bool fuse_increment(parser_t* parser, size_t start) {
+    chunk_t* chunk = parser->target;
+    byte_t* code = &chunk->code[start];
+    if (!parser->optimize || chunk->length - start != 7
+        || code[2] != OP_CONSTANT || code[4] != OP_ADD || code[1] != code[6]) {
+        return false;
+    }
+
+    operation_t operation;
+    if (code[0] == OP_GET_LOCAL && code[5] == OP_SET_LOCAL) {
+        operation = OP_ADD_LOCAL_CONSTANT;
+    } else if (code[0] == OP_GET_GLOBAL && code[5] == OP_SET_GLOBAL) {
+        operation = OP_ADD_GLOBAL_CONSTANT;
+    } else {
+        return false;
+    }
+
+    byte_t target = code[1];
+    byte_t constant = code[3];
+    chunk_truncate(chunk, start);
+    emit_bytes(parser, operation, target);
+    emit_byte(parser, constant);
+    return true;
+}
+
+// 'x && y' and 'x || y' need no branch when y is a local or a constant:
+// it can neither fail nor have an effect, so it may as well always be
+// evaluated. Replaces the code from the first jump on.
+static bool fuse_logical(parser_t* parser, operation_t operation, size_t jump, size_t right) {
+    chunk_t* chunk = parser->target;
+    size_t size = chunk->length - right;
+    byte_t code[4];
+    if (!(is_emitted(parser, EMITTED_LOCAL, right) || is_emitted(parser, EMITTED_CONSTANT, right))
+        || size > sizeof(code)) {
+        return false;
+    }
+
+    memcpy(code, &chunk->code[right], size);
+    chunk_truncate(chunk, jump);
+    for (size_t i = 0; i < size; ++i) {
+        emit_byte(parser, code[i]);
+    }
+    emit_byte(parser, operation);
+    return true;
 }
 
 static void grouping(parser_t* parser, bool) {
@@ -267,9 +574,25 @@ static void grouping(parser_t* parser, bool) {
 
 static void binary(parser_t* parser, bool) {
     token_type_t type = parser->previous.type;
-    parse_rule_t* rule = get_rule(type);
+    const parse_rule_t* rule = get_rule(type);
+    size_t start = parser->start;
+    bool constant = is_emitted(parser, EMITTED_CONSTANT, start);
+    bool local = is_emitted(parser, EMITTED_LOCAL, start);
+    value_t left = parser->value;
+    size_t right = parser->target->length;
     parse_precedence(parser, (precendense_t)rule->precendense + 1);
 
+    value_t result;
+    if (constant && is_emitted(parser, EMITTED_CONSTANT, right)
+        && fold_binary(type, left, parser->value, &result)) {
+        chunk_truncate(parser->target, start);
+        return emit_value(parser, result);
+    }
+
+    if (local && fuse_binary(parser, type, start, right)) {
+        return;
+    }
+
     switch (type) {
         case TOKEN_BANG_EQUAL: emit_byte(parser, OP_NOT_EQUAL); break;
         case TOKEN_EQUAL_EQUAL: emit_byte(parser, OP_EQUAL); break;
@@ -284,12 +607,76 @@ static void binary(parser_t* parser, bool) {
         case TOKEN_PERCENT: emit_byte(parser, OP_MODULO); break;
         default: return;
     }
+
+    if (rule->precendense <= PREC_COMPARISON) {
+        emitted(parser, EMITTED_COMPARISON, start);
+    }
+}
+
+static byte_t argument_list(parser_t* parser) {
+    size_t count = 0;
+    if (parser->current.type != TOKEN_RIGHT_PAREN) {
+        do {
+            expression(parser, false);
+            if (count == UINT8_MAX) {
+                error(parser, "Can't have more than 255 arguments.");
+            }
+            ++count;
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return (byte_t) count;
+}
+
+static void call(parser_t* parser, bool) {
+    byte_t count = argument_list(parser);
+    parser->call_at = parser->target->length;
+    emit_bytes(parser, OP_CALL, count);
+}
+
+// The left operand decides: its value is the result unless the right
+// one has to be evaluated, in which case it is popped first.
+static void logic_and(parser_t* parser, bool) {
+    size_t end_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+    emit_byte(parser, OP_POP);
+    size_t right = parser->target->length;
+    parse_precedence(parser, PREC_AND);
+
+    if (!fuse_logical(parser, OP_AND, end_jump - 1, right)) {
+        patch_jump(parser, end_jump);
+    }
+}
+
+static void logic_or(parser_t* parser, bool) {
+    size_t else_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+    size_t end_jump = emit_jump(parser, OP_JUMP);
+    patch_jump(parser, else_jump);
+    emit_byte(parser, OP_POP);
+    size_t right = parser->target->length;
+    parse_precedence(parser, PREC_OR);
+
+    if (!fuse_logical(parser, OP_OR, else_jump - 1, right)) {
+        patch_jump(parser, end_jump);
+    }
 }
 
 static void unary(parser_t* parser, bool) {
     token_type_t type = parser->previous.type;
+    size_t start = parser->target->length;
     parse_precedence(parser, PREC_UNARY);
 
+    value_t result;
+    if (is_emitted(parser, EMITTED_CONSTANT, start) && fold_unary(type, parser->value, &result)) {
+        chunk_truncate(parser->target, start);
+        return emit_value(parser, result);
+    }
+
+    if (is_emitted(parser, EMITTED_COMPARISON, start) && type == TOKEN_BANG) {
+        byte_t* operation = &parser->target->code[parser->target->length - 1];
+        *operation = negate_comparison((operation_t) *operation);
+        return;
+    }
+
     switch (type) {
         case TOKEN_BANG: emit_byte(parser, OP_NOT); break;
         case TOKEN_MINUS: emit_byte(parser, OP_NEGATE); break;
@@ -299,9 +686,9 @@ static void unary(parser_t* parser, bool) {
 
 static void literal(parser_t* parser, bool) {
     switch (parser->previous.type) {
-        case TOKEN_NULL: emit_byte(parser, OP_NULL); break;
-        case TOKEN_TRUE: emit_byte(parser, OP_TRUE); break;
-        case TOKEN_FALSE: emit_byte(parser, OP_FALSE); break;
+        case TOKEN_NULL: emit_value(parser, NULL_VAL); break;
+        case TOKEN_TRUE: emit_value(parser, BOOL_VAL(true)); break;
+        case TOKEN_FALSE: emit_value(parser, BOOL_VAL(false)); break;
         default: return;
     }
 }
@@ -320,11 +707,24 @@ static void expression(parser_t* parser, bool) {
 }
 
 static inline void named_variable(parser_t* parser, token_t name, bool can_assign) {
+    int slot = resolve_local(parser, &name);
+    if (slot != -1) {
+        if (can_assign && match(parser, TOKEN_EQUAL)) {
+            expression(parser, can_assign);
+            emit_bytes(parser, OP_SET_LOCAL, (byte_t) slot);
+        } else {
+            emit_bytes(parser, OP_GET_LOCAL, (byte_t) slot);
+            emitted(parser, EMITTED_LOCAL, parser->target->length - 2);
+        }
+        return;
+    }
+
+    size_t global = id_constant(parser, &name);
     if (can_assign && match(parser, TOKEN_EQUAL)) {
         expression(parser, can_assign);
-        emit_bytes(parser, OP_SET_GLOBAL, id_constant(parser, &name));
+        emit_indexed(parser, OP_SET_GLOBAL, OP_SET_GLOBAL_LONG, global);
     } else {
-        emit_bytes(parser, OP_GET_GLOBAL, id_constant(parser, &name));
+        emit_indexed(parser, OP_GET_GLOBAL, OP_GET_GLOBAL_LONG, global);
     }
 }
 
@@ -338,14 +738,204 @@ static void print_statement(parser_t* parser) {
     emit_byte(parser, OP_PRINT);
 }
 
+static void return_statement(parser_t* parser) {
+    if (parser->function == NULL) {
+        error(parser, "Can't return from top-level code.");
+    }
+
+    if (match(parser, TOKEN_SEMICOLON)) {
+        emit_byte(parser, OP_NULL);
+    } else {
+        parser->call_at = SIZE_MAX;
+        expression(parser, false);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+        // A call whose result is returned as is can reuse the frame.
+        chunk_t* chunk = parser->target;
+        if (parser->call_at != SIZE_MAX && parser->call_at + 2 == chunk->length) {
+            chunk->code[parser->call_at] = OP_TAIL_CALL;
+        }
+    }
+    emit_return(parser);
+}
+
 static void expr_statement(parser_t* parser) {
+    size_t start = parser->target->length;
     expression(parser, false);
     consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+
+    if (is_emitted(parser, EMITTED_CONSTANT, start) || is_emitted(parser, EMITTED_LOCAL, start)) {
+        return chunk_truncate(parser->target, start);
+    }
+
+    if (!fuse_increment(parser, start)) {
+        emit_byte(parser, OP_POP);
+    }
+}
+
+static void condition(parser_t* parser, const char* message) {
+    consume(parser, TOKEN_LEFT_PAREN, message);
+    expression(parser, false);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+}
+
+// The condition stays on the stack for the jump, so each branch starts
+// by popping it.
+static void if_statement(parser_t* parser) {
+    condition(parser, "Expect '(' after 'if'.");
+    size_t then_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
     emit_byte(parser, OP_POP);
+    statement(parser);
+
+    size_t else_jump = emit_jump(parser, OP_JUMP);
+    patch_jump(parser, then_jump);
+    emit_byte(parser, OP_POP);
+    if (match(parser, TOKEN_ELSE)) {
+        statement(parser);
+    }
+    patch_jump(parser, else_jump);
+}
+
+static void while_statement(parser_t* parser) {
+    size_t start = parser->target->length;
+    condition(parser, "Expect '(' after 'while'.");
+    size_t exit_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+    emit_byte(parser, OP_POP);
+    statement(parser);
+    emit_loop(parser, start);
+
+    patch_jump(parser, exit_jump);
+    emit_byte(parser, OP_POP);
+}
+
+static bool writes_local(chunk_t* chunk, size_t from, byte_t slot) {
+    for (size_t offset = from; offset < chunk->length;) {
+        byte_t* code = &chunk->code[offset];
+        switch (*code) {
+            case OP_SET_LOCAL:
+            case OP_ADD_LOCAL_CONSTANT:
+            case OP_FOR_LESS_CONSTANT:
+            case OP_FOR_LESS_LOCAL:
+                if (code[1] == slot) return true;
+                break;
+            default:
+                break;
+        }
+        offset += chunk_operation_size(*code);
+    }
+    return false;
+}
+
+// Matches 'for (...; i < n; i = i + k)' where n is a number constant or
+// a local, k is a number constant, and the body writes neither i nor n.
+// The entry test is kept and checks the types once; after it only the
+// loop operation writes i, so it steps and compares without checks.
+// Expects the condition and exit jump in place and the body compiled.
+static bool counted_loop(parser_t* parser, size_t start, size_t exit_jump, byte_t* increment, size_t size) {
+    chunk_t* chunk = parser->target;
+    value_t* constants = chunk->constants.values;
+    if (!parser->optimize || exit_jump == SIZE_MAX || size != 3 || increment[0] != OP_ADD_LOCAL_CONSTANT
+        || !IS_NUMBER(constants[increment[2]])) {
+        return false;
+    }
+
+    byte_t local = increment[1];
+    byte_t* condition = &chunk->code[start];
+    size_t body = exit_jump + 3;
+    operation_t operation;
+    byte_t limit;
+    if (exit_jump - 1 - start == 3 && condition[0] == OP_LESS_LOCAL_CONSTANT && condition[1] == local
+        && IS_NUMBER(constants[condition[2]])) {
+        operation = OP_FOR_LESS_CONSTANT;
+        limit = condition[2];
+    } else if (exit_jump - 1 - start == 5 && condition[0] == OP_GET_LOCAL && condition[1] == local
+        && condition[2] == OP_GET_LOCAL && condition[4] == OP_LESS && !writes_local(chunk, body, condition[3])) {
+        operation = OP_FOR_LESS_LOCAL;
+        limit = condition[3];
+    } else {
+        return false;
+    }
+
+    if (writes_local(chunk, body, local)) {
+        return false;
+    }
+
+    emit_bytes(parser, operation, local);
+    emit_bytes(parser, limit, increment[2]);
+    size_t jump = chunk->length + 2 - body;
+    if (jump > JUMP_MAX) {
+        error(parser, "Loop body too large.");
+    }
+    emit_bytes(parser, (byte_t)(jump & 0xff), (byte_t)((jump >> 8) & 0xff));
+
+    // Leaving through the loop operation leaves no condition to pop.
+    size_t end_jump = emit_jump(parser, OP_JUMP);
+    patch_jump(parser, exit_jump);
+    emit_byte(parser, OP_POP);
+    patch_jump(parser, end_jump);
+    return true;
+}
+
+// The increment is compiled where it is written, then moved after the
+// body, so an iteration takes a single backward jump. Jumps are
+// relative, so any inside the increment survive the move.
+static void for_statement(parser_t* parser) {
+    chunk_t* chunk = parser->target;
+    begin_scope(parser);
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    if (match(parser, TOKEN_VAR)) {
+        var_declaration(parser);
+    } else if (!match(parser, TOKEN_SEMICOLON)) {
+        expr_statement(parser);
+    }
+
+    size_t start = chunk->length;
+    size_t exit_jump = SIZE_MAX;
+    if (!match(parser, TOKEN_SEMICOLON)) {
+        expression(parser, false);
+        consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+        exit_jump = emit_jump(parser, OP_JUMP_IF_FALSE);
+        emit_byte(parser, OP_POP);
+    }
+
+    size_t increment = chunk->length;
+    if (parser->current.type != TOKEN_RIGHT_PAREN) {
+        expression(parser, false);
+        if (!fuse_increment(parser, increment)) {
+            emit_byte(parser, OP_POP);
+        }
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+    size_t size = chunk->length - increment;
+    byte_t* code = malloc(size + 1);
+    size_t* lines = malloc((size + 1) * sizeof(size_t));
+    for (size_t i = 0; i < size; ++i) {
+        code[i] = chunk->code[increment + i];
+        lines[i] = chunk_line(chunk, increment + i);
+    }
+    chunk_truncate(chunk, increment);
+    statement(parser);
+
+    if (!counted_loop(parser, start, exit_jump, code, size)) {
+        for (size_t i = 0; i < size; ++i) {
+            chunk_write(chunk, code[i], lines[i]);
+        }
+        parser->emitted = EMITTED_OTHER;
+        emit_loop(parser, start);
+
+        if (exit_jump != SIZE_MAX) {
+            patch_jump(parser, exit_jump);
+            emit_byte(parser, OP_POP);
+        }
+    }
+    free(code);
+    free(lines);
+    end_scope(parser);
 }
 
 static void var_declaration(parser_t* parser) {
-    byte_t global = parse_variable(parser, "Expect variable name.");
+    size_t global = parse_variable(parser, "Expect variable name.");
 
     if (match(parser, TOKEN_EQUAL)) {
         expression(parser, false);
@@ -360,13 +950,74 @@ static void var_declaration(parser_t* parser) {
 static void statement(parser_t* parser) {
     if (match(parser, TOKEN_PRINT)) {
         print_statement(parser);
+    } else if (match(parser, TOKEN_RETURN)) {
+        return_statement(parser);
+    } else if (match(parser, TOKEN_IF)) {
+        if_statement(parser);
+    } else if (match(parser, TOKEN_WHILE)) {
+        while_statement(parser);
+    } else if (match(parser, TOKEN_FOR)) {
+        for_statement(parser);
+    } else if (match(parser, TOKEN_LEFT_BRACE)) {
+        begin_scope(parser);
+        block(parser);
+        end_scope(parser);
     } else {
         expr_statement(parser);
     }
 }
 
+// Compiles the parameters and body into a chunk of their own. Functions
+// are only declared at the top level, so there are no enclosing locals
+// to save.
+static void function(parser_t* parser) {
+    function_t* function = function_new(string_copy(parser->previous.start, parser->previous.size));
+    chunk_t* enclosing = parser->target;
+    parser->target = &function->chunk;
+    parser->function = function;
+    parser->emitted = EMITTED_OTHER;
+
+    // Slot 0 holds the function being called.
+    begin_scope(parser);
+    add_local(parser, (token_t) { .size = 0 });
+    parser->locals[0].depth = parser->scope_depth;
+
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (parser->current.type != TOKEN_RIGHT_PAREN) {
+        do {
+            if (function->arity == UINT8_MAX) {
+                error_at_current(parser, "Can't have more than 255 parameters.");
+            }
+            ++function->arity;
+            define_variable(parser, parse_variable(parser, "Expect parameter name."));
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block(parser);
+
+    emit_byte(parser, OP_NULL);
+    emit_return(parser);
+    function->chunk.depth = chunk_depth(&function->chunk);
+    function_prepare(function);
+
+    parser->locals_count = 0;
+    parser->scope_depth = 0;
+    parser->function = NULL;
+    parser->target = enclosing;
+    emit_constant(parser, OBJECT_VAL(function));
+}
+
+static void func_declaration(parser_t* parser) {
+    size_t global = parse_variable(parser, "Expect function name.");
+    function(parser);
+    define_variable(parser, global);
+}
+
 static void declaration(parser_t* parser) {
-    if (match(parser, TOKEN_VAR)) {
+    if (match(parser, TOKEN_FUNC)) {
+        func_declaration(parser);
+    } else if (match(parser, TOKEN_VAR)) {
         var_declaration(parser);
     }
 }
@@ -374,7 +1025,7 @@ static void declaration(parser_t* parser) {
 static void block(parser_t* parser) {
     while (!match(parser, TOKEN_RIGHT_BRACE)) {
         if (match(parser, TOKEN_EOF)) {
-            error_at_current(parser, "Expect '}' after block.");
+            return error_at_current(parser, "Expect '}' after block.");
         }
 
         if (parser->panic) {
@@ -392,18 +1043,20 @@ static void block(parser_t* parser) {
 static void program(parser_t* parser) {
     while (!match(parser, TOKEN_PROGRAM)) {
         if (match(parser, TOKEN_EOF)) {
-            error_at_current(parser, "Expect 'program' section in code.");
+            return error_at_current(parser, "Expect 'program' section in code.");
         }
         declaration(parser);
     }
 
     consume(parser, TOKEN_LEFT_BRACE, "Expect '{' at start of 'program'.");
+    begin_scope(parser);
     block(parser);
+    end_scope(parser);
     consume(parser, TOKEN_EOF, "End of expression.");
 }
 
-extern bool parser_parse(chunk_t* chunk, const char* source) {
-    parser_t parser = { chunk };
+extern bool parser_parse(chunk_t* chunk, const char* source, bool optimize) {
+    parser_t parser = { .target = chunk, .optimize = optimize };
     lexer_init(&parser.lexer, source);
 
     advance(&parser);
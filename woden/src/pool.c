@@ -0,0 +1,97 @@
+/* Pool - A size-class allocator for runtime objects
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "pool.h"
+
+#define SLAB_SIZE (64 * 1024)
+#define CLASS_SIZE 16
+#define CLASSES 16
+
+#define size_class(size) (((size) + CLASS_SIZE - 1) / CLASS_SIZE - 1)
+
+typedef struct pool pool_t;
+typedef struct pool_node pool_node_t;
+typedef struct pool_slab pool_slab_t;
+
+struct pool_node {
+    pool_node_t* next;
+};
+
+struct pool_slab {
+    pool_slab_t* next;
+    _Alignas(CLASS_SIZE) char data[SLAB_SIZE];
+};
+
+struct pool {
+    pool_node_t* free[CLASSES];
+    pool_slab_t* slabs;
+    char* current;
+    char* end;
+};
+
+static _Thread_local pool_t pool;
+
+extern void* pool_alloc(size_t size) {
+    if (size > CLASS_SIZE * CLASSES) {
+        return malloc(size);
+    }
+
+    size_t index = size_class(size);
+    pool_node_t* node = pool.free[index];
+    if (node != NULL) {
+        pool.free[index] = node->next;
+        return node;
+    }
+
+    size = (index + 1) * CLASS_SIZE;
+    if ((size_t)(pool.end - pool.current) < size) {
+        pool_slab_t* slab = (pool_slab_t*) malloc(sizeof(pool_slab_t));
+        slab->next = pool.slabs;
+        pool.slabs = slab;
+        pool.current = slab->data;
+        pool.end = slab->data + SLAB_SIZE;
+    }
+
+    void* target = pool.current;
+    pool.current += size;
+    return target;
+}
+
+extern void pool_free(void* target, size_t size) {
+    if (size > CLASS_SIZE * CLASSES) {
+        free(target);
+        return;
+    }
+
+    size_t index = size_class(size);
+    pool_node_t* node = (pool_node_t*) target;
+    node->next = pool.free[index];
+    pool.free[index] = node;
+}
+
+extern void pool_release(void) {
+    while (pool.slabs != NULL) {
+        pool_slab_t* slab = pool.slabs;
+        pool.slabs = slab->next;
+        free(slab);
+    }
+    pool = (pool_t) { 0 };
+}
@@ -0,0 +1,507 @@
+/* Registers - Register-based bytecode
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "registers.h"
+
+#define NO_INSTRUCTION SIZE_MAX
+
+// The stack code is run symbolically. Stack entry i lives in frame slot
+// i, so locals stay in the slots they already have. A constant or local
+// read is only copied into its slot once an instruction needs it there,
+// so most operations read locals in place and pops cost nothing.
+//
+// Jumps need every path into a label to agree on where values are, so
+// all entries are copied into their own slots before a jump and at a
+// label. Forward jumps are patched once their label has been placed.
+
+typedef struct translator translator_t;
+typedef struct operand operand_t;
+typedef struct label label_t;
+typedef struct patch patch_t;
+typedef enum operand_type operand_type_t;
+
+enum operand_type {
+    OPERAND_SLOT,
+    OPERAND_LOCAL,
+    OPERAND_CONSTANT,
+    OPERAND_NULL,
+    OPERAND_TRUE,
+    OPERAND_FALSE
+};
+
+struct operand {
+    operand_type_t type;
+    size_t index;
+};
+
+// A source offset that some jump lands on. `depth` is the stack depth
+// plus one a forward jump left there, `offset` where the label went in
+// the register code.
+struct label {
+    bool target;
+    size_t depth;
+    size_t offset;
+};
+
+struct patch {
+    size_t at;
+    size_t label;
+};
+
+struct translator {
+    chunk_t* target;
+    byte_t* code;
+    byte_t* current;
+    size_t line;
+    size_t last;
+    operand_t stack[REGISTERS_SIZE];
+    size_t depth;
+    bool reachable;
+    label_t* labels;
+    patch_t* patches;
+    size_t patches_count;
+    bool error;
+};
+
+static inline void emit_byte(translator_t* translator, byte_t byte) {
+    chunk_write(translator->target, byte, translator->line);
+}
+
+static void emit_index(translator_t* translator, size_t index) {
+    emit_byte(translator, (byte_t)(index & 0xff));
+    if (index > UINT8_MAX) {
+        emit_byte(translator, (byte_t)((index >> 8) & 0xff));
+        emit_byte(translator, (byte_t)((index >> 16) & 0xff));
+    }
+}
+
+static inline byte_t long_form(register_operation_t operation, size_t index) {
+    return (byte_t)(index <= UINT8_MAX ? operation : operation + 1);
+}
+
+// Starts an instruction that writes no slot.
+static void emit_operation(translator_t* translator, byte_t operation) {
+    translator->last = NO_INSTRUCTION;
+    emit_byte(translator, operation);
+}
+
+// Starts an instruction whose first operand is the slot it writes, and
+// remembers it so a following local store can retarget it.
+static void emit_write(translator_t* translator, byte_t operation, size_t slot) {
+    translator->last = translator->target->length;
+    emit_byte(translator, operation);
+    emit_byte(translator, (byte_t) slot);
+}
+
+static void load(translator_t* translator, size_t slot, operand_t operand) {
+    switch (operand.type) {
+        case OPERAND_LOCAL:
+            emit_write(translator, REG_MOVE, slot);
+            emit_byte(translator, (byte_t) operand.index);
+            break;
+        case OPERAND_CONSTANT:
+            emit_write(translator, long_form(REG_CONSTANT, operand.index), slot);
+            emit_index(translator, operand.index);
+            break;
+        case OPERAND_NULL: emit_write(translator, REG_NULL, slot); break;
+        case OPERAND_TRUE: emit_write(translator, REG_TRUE, slot); break;
+        case OPERAND_FALSE: emit_write(translator, REG_FALSE, slot); break;
+        default: break;
+    }
+}
+
+static void materialize(translator_t* translator, size_t slot) {
+    operand_t* operand = &translator->stack[slot];
+    if (operand->type != OPERAND_SLOT && !(operand->type == OPERAND_LOCAL && operand->index == slot)) {
+        load(translator, slot, *operand);
+    }
+    operand->type = OPERAND_SLOT;
+}
+
+// Returns the slot holding the value of stack entry `slot`.
+static size_t use(translator_t* translator, size_t slot) {
+    operand_t* operand = &translator->stack[slot];
+    if (operand->type == OPERAND_LOCAL) {
+        return operand->index;
+    }
+
+    materialize(translator, slot);
+    return slot;
+}
+
+static void push(translator_t* translator, operand_type_t type, size_t index) {
+    if (translator->depth + 1 >= REGISTERS_SIZE) {
+        translator->error = true;
+        return;
+    }
+    translator->stack[translator->depth++] = (operand_t) { type, index };
+}
+
+static inline size_t top(translator_t* translator) {
+    return translator->depth - 1;
+}
+
+static void get_local(translator_t* translator, size_t local) {
+    materialize(translator, local);
+    push(translator, OPERAND_LOCAL, local);
+}
+
+static void set_local(translator_t* translator, size_t local, bool popped) {
+    for (size_t i = 0; i < translator->depth; ++i) {
+        operand_t* operand = &translator->stack[i];
+        if (i != local && operand->type == OPERAND_LOCAL && operand->index == local) {
+            materialize(translator, i);
+        }
+    }
+
+    size_t value = top(translator);
+    operand_t* operand = &translator->stack[value];
+    if (popped && operand->type == OPERAND_SLOT && translator->last != NO_INSTRUCTION
+        && translator->target->code[translator->last + 1] == value) {
+        // Nothing can read the value after the pop, so the instruction
+        // that computed it can write it straight into the local.
+        translator->target->code[translator->last + 1] = (byte_t) local;
+    } else if (operand->type == OPERAND_SLOT) {
+        load(translator, local, (operand_t) { OPERAND_LOCAL, value });
+    } else {
+        load(translator, local, *operand);
+    }
+
+    translator->stack[local].type = OPERAND_SLOT;
+    *operand = (operand_t) { OPERAND_LOCAL, local };
+    if (popped) {
+        --translator->depth;
+    }
+}
+
+static void unary(translator_t* translator, register_operation_t operation) {
+    size_t slot = top(translator);
+    size_t x = use(translator, slot);
+    emit_write(translator, operation, slot);
+    emit_byte(translator, (byte_t) x);
+    translator->stack[slot].type = OPERAND_SLOT;
+}
+
+static void binary(translator_t* translator, register_operation_t operation) {
+    size_t slot = top(translator) - 1;
+    size_t x = use(translator, slot);
+    size_t y = use(translator, slot + 1);
+    emit_write(translator, operation, slot);
+    emit_byte(translator, (byte_t) x);
+    emit_byte(translator, (byte_t) y);
+    translator->stack[slot].type = OPERAND_SLOT;
+    --translator->depth;
+}
+
+static void store(translator_t* translator, register_operation_t operation, size_t index, bool popped) {
+    size_t x = use(translator, top(translator));
+    emit_operation(translator, long_form(operation, index));
+    emit_index(translator, index);
+    emit_byte(translator, (byte_t) x);
+    if (popped) {
+        --translator->depth;
+    }
+}
+
+static void get_global(translator_t* translator, size_t index) {
+    push(translator, OPERAND_SLOT, 0);
+    emit_write(translator, long_form(REG_GET_GLOBAL, index), top(translator));
+    emit_index(translator, index);
+}
+
+static void materialize_all(translator_t* translator) {
+    for (size_t i = 0; i < translator->depth; ++i) {
+        materialize(translator, i);
+    }
+}
+
+// Code after an unconditional jump is only reached through the label,
+// where every jump to it has already put the values in their slots.
+static void enter_label(translator_t* translator, label_t* label) {
+    if (!translator->reachable && label->depth != 0) {
+        translator->depth = label->depth - 1;
+    }
+
+    for (size_t i = 0; i < translator->depth; ++i) {
+        if (translator->reachable) {
+            materialize(translator, i);
+        } else {
+            translator->stack[i].type = OPERAND_SLOT;
+        }
+    }
+    translator->last = NO_INSTRUCTION;
+    translator->reachable = true;
+    label->offset = translator->target->length;
+}
+
+static void emit_jump(translator_t* translator, size_t label) {
+    translator->labels[label].depth = translator->depth + 1;
+    translator->patches[translator->patches_count++] = (patch_t) { translator->target->length, label };
+    emit_byte(translator, 0xff);
+    emit_byte(translator, 0xff);
+}
+
+static void branch(translator_t* translator, size_t label) {
+    materialize_all(translator);
+    emit_operation(translator, REG_JUMP);
+    emit_jump(translator, label);
+    translator->reachable = false;
+}
+
+// When both ways start by popping the condition, as in if and while,
+// it is only read and never needs a slot of its own.
+static void branch_if_false(translator_t* translator, size_t label) {
+    size_t slot = top(translator);
+    size_t condition = slot;
+    if (*translator->current == OP_POP && translator->code[label] == OP_POP) {
+        condition = use(translator, slot);
+        --translator->depth;
+        materialize_all(translator);
+        ++translator->depth;
+    } else {
+        materialize_all(translator);
+    }
+
+    emit_operation(translator, REG_JUMP_IF_FALSE);
+    emit_byte(translator, (byte_t) condition);
+    emit_jump(translator, label);
+}
+
+static void emit_loop(translator_t* translator, size_t label) {
+    size_t jump = translator->target->length + 2 - translator->labels[label].offset;
+    if (jump > JUMP_MAX) {
+        translator->error = true;
+    }
+    emit_byte(translator, (byte_t)(jump & 0xff));
+    emit_byte(translator, (byte_t)((jump >> 8) & 0xff));
+}
+
+static void loop(translator_t* translator, size_t label) {
+    materialize_all(translator);
+    emit_operation(translator, REG_LOOP);
+    emit_loop(translator, label);
+    translator->reachable = false;
+}
+
+static inline size_t read_byte(translator_t* translator) {
+    return *translator->current++;
+}
+
+static inline size_t read_long(translator_t* translator) {
+    byte_t* current = (translator->current += 3);
+    return current[-3] | current[-2] << 8 | current[-1] << 16;
+}
+
+static inline size_t read_short(translator_t* translator) {
+    byte_t* current = (translator->current += 2);
+    return current[-2] | current[-1] << 8;
+}
+
+static inline size_t offset(translator_t* translator) {
+    return (size_t)(translator->current - translator->code);
+}
+
+// The counter, limit and step keep their operands; only the jump back
+// is moved to the register code.
+static void for_loop(translator_t* translator, register_operation_t operation) {
+    byte_t* operands = translator->current;
+    translator->current += 3;
+    size_t jump = read_short(translator);
+
+    materialize_all(translator);
+    emit_operation(translator, operation);
+    for (size_t i = 0; i < 3; ++i) {
+        emit_byte(translator, operands[i]);
+    }
+    emit_loop(translator, offset(translator) - jump);
+}
+
+static bool translate(translator_t* translator, byte_t operation) {
+    switch (operation) {
+        case OP_CONSTANT: push(translator, OPERAND_CONSTANT, read_byte(translator)); break;
+        case OP_CONSTANT_LONG: push(translator, OPERAND_CONSTANT, read_long(translator)); break;
+        case OP_NULL: push(translator, OPERAND_NULL, 0); break;
+        case OP_TRUE: push(translator, OPERAND_TRUE, 0); break;
+        case OP_FALSE: push(translator, OPERAND_FALSE, 0); break;
+        case OP_NOT: unary(translator, REG_NOT); break;
+        case OP_NEGATE: unary(translator, REG_NEGATE); break;
+        case OP_DIVIDE:
+        case OP_DIVIDE_NUM: binary(translator, REG_DIVIDE); break;
+        case OP_MULTIPLY:
+        case OP_MULTIPLY_NUM: binary(translator, REG_MULTIPLY); break;
+        case OP_MODULO: binary(translator, REG_MODULO); break;
+        case OP_SUBTRACT:
+        case OP_SUBTRACT_NUM: binary(translator, REG_SUBTRACT); break;
+        case OP_ADD:
+        case OP_ADD_NUM:
+        case OP_ADD_ANY: binary(translator, REG_ADD); break;
+        case OP_EQUAL: binary(translator, REG_EQUAL); break;
+        case OP_NOT_EQUAL: binary(translator, REG_NOT_EQUAL); break;
+        case OP_LESS:
+        case OP_LESS_NUM: binary(translator, REG_LESS); break;
+        case OP_LESS_EQUAL:
+        case OP_LESS_EQUAL_NUM: binary(translator, REG_LESS_EQUAL); break;
+        case OP_GREATER:
+        case OP_GREATER_NUM: binary(translator, REG_GREATER); break;
+        case OP_GREATER_EQUAL:
+        case OP_GREATER_EQUAL_NUM: binary(translator, REG_GREATER_EQUAL); break;
+        case OP_AND: binary(translator, REG_AND); break;
+        case OP_OR: binary(translator, REG_OR); break;
+        case OP_PRINT: {
+            size_t x = use(translator, top(translator));
+            emit_operation(translator, REG_PRINT);
+            emit_byte(translator, (byte_t) x);
+            --translator->depth;
+            break;
+        }
+        case OP_POP: --translator->depth; break;
+        case OP_DEFINE_GLOBAL: store(translator, REG_DEFINE_GLOBAL, read_byte(translator), true); break;
+        case OP_DEFINE_GLOBAL_LONG: store(translator, REG_DEFINE_GLOBAL, read_long(translator), true); break;
+        case OP_GET_GLOBAL: get_global(translator, read_byte(translator)); break;
+        case OP_GET_GLOBAL_LONG: get_global(translator, read_long(translator)); break;
+        case OP_SET_GLOBAL: store(translator, REG_SET_GLOBAL, read_byte(translator), false); break;
+        case OP_SET_GLOBAL_LONG: store(translator, REG_SET_GLOBAL, read_long(translator), false); break;
+        case OP_GET_LOCAL: get_local(translator, read_byte(translator)); break;
+        case OP_SET_LOCAL: {
+            size_t local = read_byte(translator);
+            bool popped = *translator->current == OP_POP && !translator->labels[offset(translator)].target;
+            translator->current += popped;
+            set_local(translator, local, popped);
+            break;
+        }
+        case OP_ADD_LOCALS: {
+            get_local(translator, read_byte(translator));
+            get_local(translator, read_byte(translator));
+            binary(translator, REG_ADD);
+            break;
+        }
+        case OP_LESS_LOCAL_CONSTANT: {
+            get_local(translator, read_byte(translator));
+            push(translator, OPERAND_CONSTANT, read_byte(translator));
+            binary(translator, REG_LESS);
+            break;
+        }
+        case OP_ADD_LOCAL_CONSTANT: {
+            size_t local = read_byte(translator);
+            get_local(translator, local);
+            push(translator, OPERAND_CONSTANT, read_byte(translator));
+            binary(translator, REG_ADD);
+            set_local(translator, local, true);
+            break;
+        }
+        case OP_ADD_GLOBAL_CONSTANT: {
+            size_t global = read_byte(translator);
+            get_global(translator, global);
+            push(translator, OPERAND_CONSTANT, read_byte(translator));
+            binary(translator, REG_ADD);
+            store(translator, REG_SET_GLOBAL, global, true);
+            break;
+        }
+        case OP_JUMP: {
+            size_t jump = read_short(translator);
+            branch(translator, offset(translator) + jump);
+            break;
+        }
+        case OP_JUMP_IF_FALSE: {
+            size_t jump = read_short(translator);
+            branch_if_false(translator, offset(translator) + jump);
+            break;
+        }
+        case OP_LOOP: {
+            size_t jump = read_short(translator);
+            loop(translator, offset(translator) - jump);
+            break;
+        }
+        case OP_FOR_LESS_CONSTANT: for_loop(translator, REG_FOR_LESS_CONSTANT); break;
+        case OP_FOR_LESS_LOCAL: for_loop(translator, REG_FOR_LESS_LOCAL); break;
+        case OP_RETURN: emit_operation(translator, REG_RETURN); break;
+        case OP_CALL:
+        case OP_TAIL_CALL: translator->error = true; break;
+        default: emit_operation(translator, UINT8_MAX); break;
+    }
+    return !translator->error;
+}
+
+// Marks every offset a jump lands on and returns how many jumps there are.
+static size_t find_labels(label_t* labels, chunk_t* source) {
+    size_t count = 0;
+    for (size_t offset = 0; offset < source->length;) {
+        byte_t* code = &source->code[offset];
+        offset += chunk_operation_size(*code);
+        if (*code == OP_JUMP || *code == OP_JUMP_IF_FALSE || *code == OP_LOOP
+            || *code == OP_FOR_LESS_CONSTANT || *code == OP_FOR_LESS_LOCAL) {
+            byte_t* operand = &source->code[offset - 2];
+            size_t jump = operand[0] | operand[1] << 8;
+            size_t label = *code == OP_JUMP || *code == OP_JUMP_IF_FALSE ? offset + jump : offset - jump;
+            if (label < source->length) {
+                labels[label].target = true;
+            }
+            ++count;
+        }
+    }
+    return count;
+}
+
+static bool patch_jumps(translator_t* translator) {
+    byte_t* code = translator->target->code;
+    for (size_t i = 0; i < translator->patches_count; ++i) {
+        patch_t* patch = &translator->patches[i];
+        size_t jump = translator->labels[patch->label].offset - patch->at - 2;
+        if (jump > JUMP_MAX) {
+            return false;
+        }
+        code[patch->at] = (byte_t)(jump & 0xff);
+        code[patch->at + 1] = (byte_t)((jump >> 8) & 0xff);
+    }
+    return true;
+}
+
+extern bool registers_compile(chunk_t* target, chunk_t* source) {
+    translator_t translator = {
+        .target = target,
+        .code = source->code,
+        .current = source->code,
+        .last = NO_INSTRUCTION,
+        .reachable = true
+    };
+    translator.labels = calloc(source->length + 1, sizeof(label_t));
+    translator.patches = malloc((find_labels(translator.labels, source) + 1) * sizeof(patch_t));
+
+    bool result = true;
+    byte_t* end = source->code + source->length;
+    size_t run = 0;
+    while (result && translator.current < end) {
+        size_t at = offset(&translator);
+        while (run < source->lines_length && source->lines[run].offset <= at) {
+            translator.line = source->lines[run++].line;
+        }
+        if (translator.labels[at].target) {
+            enter_label(&translator, &translator.labels[at]);
+        }
+        result = translate(&translator, *translator.current++);
+    }
+
+    result = result && patch_jumps(&translator);
+    free(translator.labels);
+    free(translator.patches);
+    return result;
+}
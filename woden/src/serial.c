@@ -0,0 +1,341 @@
+/* Serial - Bytecode serialization
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "serial.h"
+#include "object.h"
+#include "gc.h"
+
+#define MAGIC "WODN"
+
+#define align(size) (((size) + 7) & ~(size_t) 7)
+
+#define FNV_OFFSET 14695981039346656037u
+#define FNV_PRIME 1099511628211u
+
+typedef struct header header_t;
+typedef enum tag tag_t;
+
+struct header {
+    char magic[4];
+    uint32_t version;
+    uint64_t hash;
+    uint64_t checksum;
+    uint64_t code_length;
+    uint64_t lines_length;
+    uint64_t constants_length;
+    uint64_t depth;
+};
+
+enum tag {
+    TAG_NULL_VALUE,
+    TAG_BOOL_VALUE,
+    TAG_NUMBER_VALUE,
+    TAG_STRING_VALUE,
+    TAG_FUNCTION_VALUE
+};
+
+static bool write_constant(FILE* file, value_t value);
+
+// A function is written as its arity, name, depth, code and lines,
+// followed by its own constants.
+static bool write_function(FILE* file, function_t* function) {
+    chunk_t* chunk = &function->chunk;
+    uint8_t tag = TAG_FUNCTION_VALUE;
+    uint64_t header[] = {
+        function->name->size, function->arity, chunk->depth,
+        chunk->length, chunk->lines_length, chunk->constants.length
+    };
+
+    bool success = fwrite(&tag, 1, 1, file) == 1
+        && fwrite(header, sizeof(header), 1, file) == 1
+        && fwrite(function->name->target, 1, function->name->size, file) == function->name->size
+        && fwrite(chunk->code, sizeof(byte_t), chunk->length, file) == chunk->length
+        && fwrite(chunk->lines, sizeof(line_t), chunk->lines_length, file) == chunk->lines_length;
+
+    for (size_t i = 0; success && i < chunk->constants.length; ++i) {
+        success = write_constant(file, chunk->constants.values[i]);
+    }
+    return success;
+}
+
+static bool write_constant(FILE* file, value_t value) {
+    uint8_t tag;
+    if (IS_NULL(value)) {
+        tag = TAG_NULL_VALUE;
+        return fwrite(&tag, 1, 1, file) == 1;
+    }
+
+    if (IS_BOOL(value)) {
+        uint8_t data[2] = { TAG_BOOL_VALUE, AS_BOOL(value) };
+        return fwrite(data, 1, 2, file) == 2;
+    }
+
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        tag = TAG_NUMBER_VALUE;
+        return fwrite(&tag, 1, 1, file) == 1
+            && fwrite(&number, sizeof(double), 1, file) == 1;
+    }
+
+    if (IS_STRING(value)) {
+        string_t* string = AS_STRING(value);
+        uint32_t size = (uint32_t) string->size;
+        tag = TAG_STRING_VALUE;
+        return fwrite(&tag, 1, 1, file) == 1
+            && fwrite(&size, sizeof(uint32_t), 1, file) == 1
+            && fwrite(string->target, 1, size, file) == size;
+    }
+
+    if (IS_FUNCTION(value)) {
+        return write_function(file, AS_FUNCTION(value));
+    }
+    return false;
+}
+
+static bool read_constant(chunk_t* chunk, const uint8_t** current, const uint8_t* end);
+
+// Function code is copied out of the image, since the function can
+// outlive the chunk that maps it.
+static bool read_function(value_t* value, const uint8_t** current, const uint8_t* end) {
+    uint64_t header[6];
+    if ((size_t)(end - *current) < sizeof(header)) return false;
+    memcpy(header, *current, sizeof(header));
+    *current += sizeof(header);
+
+    uint64_t name_size = header[0];
+    uint64_t code_length = header[3];
+    uint64_t lines_length = header[4];
+    if ((size_t)(end - *current) < name_size
+        || (size_t)(end - *current) - name_size < code_length
+        || (size_t)(end - *current) - name_size - code_length < lines_length * sizeof(line_t)) {
+        return false;
+    }
+
+    function_t* function = function_new(string_copy((const char*) *current, name_size));
+    function->arity = header[1];
+    *current += name_size;
+    const uint8_t* code = *current;
+    const uint8_t* lines = code + code_length;
+    size_t run = 0;
+    line_t line = { 0, 0 };
+    for (size_t offset = 0; offset < code_length; ++offset) {
+        // Entries follow the code unaligned.
+        while (run < lines_length) {
+            line_t next;
+            memcpy(&next, lines + run * sizeof(line_t), sizeof(line_t));
+            if (next.offset > offset) break;
+            line = next;
+            ++run;
+        }
+        chunk_write(&function->chunk, code[offset], line.line);
+    }
+    *current += code_length + lines_length * sizeof(line_t);
+
+    for (uint64_t i = 0; i < header[5]; ++i) {
+        if (!read_constant(&function->chunk, current, end)) return false;
+    }
+
+    function->chunk.depth = header[2];
+    function_prepare(function);
+    *value = OBJECT_VAL(function);
+    return true;
+}
+
+static bool read_constant(chunk_t* chunk, const uint8_t** current, const uint8_t* end) {
+    if (*current >= end) return false;
+
+    value_t value;
+    switch (*(*current)++) {
+        case TAG_NULL_VALUE:
+            value = NULL_VAL;
+            break;
+        case TAG_BOOL_VALUE: {
+            if (end - *current < 1) return false;
+            value = BOOL_VAL(*(*current)++ != 0);
+            break;
+        }
+        case TAG_NUMBER_VALUE: {
+            double number;
+            if (end - *current < (ptrdiff_t) sizeof(double)) return false;
+            memcpy(&number, *current, sizeof(double));
+            *current += sizeof(double);
+            value = NUMBER_VAL(number);
+            break;
+        }
+        case TAG_STRING_VALUE: {
+            uint32_t size;
+            if (end - *current < (ptrdiff_t) sizeof(uint32_t)) return false;
+            memcpy(&size, *current, sizeof(uint32_t));
+            *current += sizeof(uint32_t);
+            if ((size_t)(end - *current) < size) return false;
+            value = OBJECT_VAL(string_copy((const char*) *current, size));
+            *current += size;
+            break;
+        }
+        case TAG_FUNCTION_VALUE:
+            if (!read_function(&value, current, end)) return false;
+            break;
+        default:
+            return false;
+    }
+
+    varray_push(&chunk->constants, value);
+    gc_pin(value);
+    return true;
+}
+
+static bool write_padding(FILE* file, size_t size) {
+    static const char zeros[8] = { 0 };
+    return fwrite(zeros, 1, align(size) - size, file) == align(size) - size;
+}
+
+static uint64_t fnv(uint64_t hash, const uint8_t* bytes, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// The image is run without checking its operands, so everything after
+// the header is hashed to catch a damaged file before it gets that far.
+static bool write_checksum(FILE* file) {
+    uint8_t buffer[4096];
+    uint64_t checksum = FNV_OFFSET;
+    if (fflush(file) != 0 || fseek(file, sizeof(header_t), SEEK_SET) != 0) {
+        return false;
+    }
+
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        checksum = fnv(checksum, buffer, count);
+    }
+
+    return !ferror(file)
+        && fseek(file, offsetof(header_t, checksum), SEEK_SET) == 0
+        && fwrite(&checksum, sizeof(checksum), 1, file) == 1;
+}
+
+// The flag goes in ahead of the source, so optimized and plain builds
+// of a script hash as differently as two scripts would.
+extern uint64_t serial_hash(const char* source, size_t size, bool optimize) {
+    uint8_t flag = optimize;
+    return fnv(fnv(FNV_OFFSET, &flag, 1), (const uint8_t*) source, size);
+}
+
+extern bool serial_save(chunk_t* chunk, const char* path, uint64_t hash) {
+    char temp[4096];
+    if (snprintf(temp, sizeof(temp), "%s.%ld.tmp", path, (long) getpid()) >= (int) sizeof(temp)) {
+        return false;
+    }
+
+    FILE* file = fopen(temp, "w+b");
+    if (file == NULL) {
+        return false;
+    }
+
+    header_t header = {
+        .magic = MAGIC,
+        .version = SERIAL_VERSION,
+        .hash = hash,
+        .code_length = chunk->length,
+        .lines_length = chunk->lines_length,
+        .constants_length = chunk->constants.length,
+        .depth = chunk->depth
+    };
+
+    bool success = fwrite(&header, sizeof(header_t), 1, file) == 1
+        && fwrite(chunk->code, sizeof(byte_t), chunk->length, file) == chunk->length
+        && write_padding(file, chunk->length)
+        && fwrite(chunk->lines, sizeof(line_t), chunk->lines_length, file) == chunk->lines_length;
+
+    for (size_t i = 0; success && i < chunk->constants.length; ++i) {
+        success = write_constant(file, chunk->constants.values[i]);
+    }
+
+    success = success && write_checksum(file);
+    success = fclose(file) == 0 && success;
+    if (!success || rename(temp, path) != 0) {
+        unlink(temp);
+        return false;
+    }
+    return true;
+}
+
+extern bool serial_load(chunk_t* chunk, const char* path, uint64_t hash) {
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor == -1) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || (size_t) info.st_size < sizeof(header_t)) {
+        close(descriptor);
+        return false;
+    }
+
+    size_t size = (size_t) info.st_size;
+    uint8_t* image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (image == MAP_FAILED) {
+        return false;
+    }
+
+    header_t* header = (header_t*) image;
+    const uint8_t* end = image + size;
+    const uint8_t* current = image + sizeof(header_t);
+    size_t lines_size = header->lines_length * sizeof(line_t);
+
+    if (memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0
+        || header->version != SERIAL_VERSION || header->hash != hash
+        || header->checksum != fnv(FNV_OFFSET, current, (size_t)(end - current))
+        || (size_t)(end - current) < align(header->code_length)
+        || (size_t)(end - current) - align(header->code_length) < lines_size) {
+        munmap(image, size);
+        return false;
+    }
+
+    chunk->code = (byte_t*) current;
+    chunk->size = chunk->length = header->code_length;
+    chunk->depth = header->depth;
+    current += align(header->code_length);
+
+    chunk->lines = (line_t*) current;
+    chunk->lines_size = chunk->lines_length = header->lines_length;
+    current += lines_size;
+
+    for (uint64_t i = 0; i < header->constants_length; ++i) {
+        if (!read_constant(chunk, &current, end)) {
+            munmap(image, size);
+            return false;
+        }
+    }
+
+    chunk->image = image;
+    chunk->image_size = size;
+    return true;
+}
@@ -0,0 +1,58 @@
+/* Stack - A stack of values
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include "stack.h"
+#include "array.h"
+
+extern void stack_init(stack_t* stack, size_t limit) {
+    stack->size = STACK_SIZE < limit ? STACK_SIZE : limit;
+    stack->limit = limit;
+    stack->values = array_alloc(value_t, stack->size);
+    stack->current = stack->values;
+}
+
+extern void stack_free(stack_t* stack) {
+    free(stack->values);
+    stack->values = stack->current = NULL;
+    stack->size = 0;
+}
+
+extern bool stack_reserve(stack_t* stack, size_t depth) {
+    size_t length = (size_t)(stack->current - stack->values);
+    if (depth > stack->limit - length) {
+        return false;
+    }
+
+    if (length + depth > stack->size) {
+        size_t size = stack->size;
+        while (size < length + depth) {
+            size *= 2;
+        }
+        if (size > stack->limit) {
+            size = stack->limit;
+        }
+
+        array_resize(value_t, stack->values, size);
+        stack->current = stack->values + length;
+        stack->size = size;
+    }
+    return true;
+}
@@ -22,47 +22,153 @@
 #include "table.h"
 #include "array.h"
 #include "object.h"
+#include "gc.h"
+
+#define BASE_SIZE 8
+#define MAX_LOAD(size) ((size) / 4 * 3)
 
 struct table_storage {
     string_t* key;
     value_t value;
-    table_storage_t* next;
 };
 
-extern void table_init(table_t* table) {
-    for (size_t i = 0; i < TABLE_SIZE; ++i) {
-        table->storages[i] = NULL;
+static _Thread_local size_t versions = 0;
+
+static inline bool is_tombstone(table_storage_t* storage) {
+    return storage->key == NULL && !IS_NULL(storage->value);
+}
+
+static table_storage_t* table_find(table_storage_t* storages, size_t size, string_t* key) {
+    size_t mask = size - 1;
+    table_storage_t* tombstone = NULL;
+
+    for (size_t index = key->hash & mask;; index = (index + 1) & mask) {
+        table_storage_t* storage = &storages[index];
+        if (storage->key == NULL) {
+            if (!is_tombstone(storage)) {
+                return tombstone != NULL ? tombstone : storage;
+            }
+            if (tombstone == NULL) {
+                tombstone = storage;
+            }
+        } else if (storage->key == key) {
+            return storage;
+        }
     }
 }
 
-extern void table_free(table_t* table) {
-    for (size_t i = 0; i < TABLE_SIZE; ++i) {
-        table_storage_t* storage = table->storages[i];
-        while (storage != NULL) {
-            table_storage_t* current = storage;
-            storage = storage->next;
-            free(current);
+static void table_resize(table_t* table, size_t size) {
+    table_storage_t* storages = array_alloc(table_storage_t, size);
+    for (size_t i = 0; i < size; ++i) {
+        storages[i].key = NULL;
+        storages[i].value = NULL_VAL;
+    }
+
+    table->length = 0;
+    for (size_t i = 0; i < table->size; ++i) {
+        table_storage_t* storage = &table->storages[i];
+        if (storage->key != NULL) {
+            *table_find(storages, size, storage->key) = *storage;
+            ++table->length;
         }
     }
+
+    free(table->storages);
+    table->storages = storages;
+    table->size = size;
+    table->version = ++versions;
+}
+
+extern void table_init(table_t* table) {
+    table->size = 0;
+    table->length = 0;
+    table->version = ++versions;
+    table->storages = NULL;
+}
+
+extern void table_free(table_t* table) {
+    free(table->storages);
+    table->size = 0;
+    table->length = 0;
+    table->storages = NULL;
+    table->version = ++versions;
 }
 
 extern value_t* table_get(table_t* table, string_t* key) {
-    table_storage_t* storage = table->storages[key->hash % TABLE_SIZE];
-    while (storage != NULL) {
-        if (!strcmp(storage->key->target, key->target)) {
-            return &storage->value;
-        }
-        storage = storage->next;
+    if (table->length == 0) {
+        return NULL;
     }
-    return NULL;
+
+    table_storage_t* storage = table_find(table->storages, table->size, key);
+    return storage->key == NULL ? NULL : &storage->value;
 }
 
-extern void table_set(table_t* table, string_t* key, value_t value) {
-    table_storage_t* storage = (table_storage_t*) malloc(sizeof(table_storage_t));
+extern bool table_set(table_t* table, string_t* key, value_t value) {
+    if (table->length + 1 > MAX_LOAD(table->size)) {
+        table_resize(table, table->size < BASE_SIZE ? BASE_SIZE : table->size * 2);
+    }
+
+    table_storage_t* storage = table_find(table->storages, table->size, key);
+    bool is_new = storage->key == NULL;
+    if (is_new && !is_tombstone(storage)) {
+        ++table->length;
+    }
+
     storage->key = key;
     storage->value = value;
+    return is_new;
+}
+
+extern bool table_delete(table_t* table, string_t* key) {
+    if (table->length == 0) {
+        return false;
+    }
+
+    table_storage_t* storage = table_find(table->storages, table->size, key);
+    if (storage->key == NULL) {
+        return false;
+    }
+
+    storage->key = NULL;
+    storage->value = BOOL_VAL(true);
+    table->version = ++versions;
+    return true;
+}
+
+extern string_t* table_find_string(table_t* table, const char* chars, size_t size, uint32_t hash) {
+    if (table->length == 0) {
+        return NULL;
+    }
 
-    size_t index = key->hash % TABLE_SIZE;
-    storage->next = table->storages[index];
-    table->storages[index] = storage;
+    size_t mask = table->size - 1;
+    for (size_t index = hash & mask;; index = (index + 1) & mask) {
+        table_storage_t* storage = &table->storages[index];
+        if (storage->key == NULL) {
+            if (!is_tombstone(storage)) {
+                return NULL;
+            }
+        } else if (storage->key->hash == hash && storage->key->size == size
+            && !memcmp(storage->key->target, chars, size)) {
+            return storage->key;
+        }
+    }
+}
+
+extern void table_mark(table_t* table) {
+    for (size_t i = 0; i < table->size; ++i) {
+        table_storage_t* storage = &table->storages[i];
+        if (storage->key != NULL) {
+            gc_mark_object(&storage->key->object);
+            gc_mark_value(storage->value);
+        }
+    }
+}
+
+extern void table_sweep(table_t* table) {
+    for (size_t i = 0; i < table->size; ++i) {
+        table_storage_t* storage = &table->storages[i];
+        if (storage->key != NULL && !storage->key->object.marked && storage->key->object.pins == 0) {
+            table_delete(table, storage->key);
+        }
+    }
 }
@@ -18,32 +18,38 @@
  */
 
 #include <stdio.h>
-#include <string.h>
 
 #include "value.h"
 #include "object.h"
 
 extern void value_print(value_t value) {
-    switch (value.type) {
-        case VAL_NULL: printf("null"); break;
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
-        case VAL_BOOL: printf(AS_BOOL(value) ? "true" : "false"); break;
-        case VAL_OBJECT: object_print(value); break;
-        default: printf("<VALUE>");
+    if (IS_NULL(value)) {
+        printf("null");
+    } else if (IS_NUMBER(value)) {
+        printf("%g", AS_NUMBER(value));
+    } else if (IS_BOOL(value)) {
+        printf(AS_BOOL(value) ? "true" : "false");
+    } else if (IS_OBJECT(value)) {
+        object_print(value);
+    } else {
+        printf("<VALUE>");
     }
 }
 
 extern bool value_equal(value_t x, value_t y) {
+    if (IS_NUMBER(x) && IS_NUMBER(y)) {
+        return AS_NUMBER(x) == AS_NUMBER(y);
+    }
+
+#ifdef WODEN_NAN_BOXING
+    return x == y;
+#else
     if (x.type != y.type) return false;
     switch (x.type) {
         case VAL_BOOL: return AS_BOOL(x) == AS_BOOL(y);
         case VAL_NULL: return true;
-        case VAL_NUMBER: return AS_NUMBER(x) == AS_NUMBER(y);
-        case VAL_OBJECT: {
-            string_t* a = AS_STRING(x);
-            string_t* b = AS_STRING(y);
-            return a->size == b->size && memcmp(a->target, b->target, a->size) == 0;
-        }
+        case VAL_OBJECT: return AS_OBJECT(x) == AS_OBJECT(y);
         default: return false;
     }
+#endif
 }
@@ -23,19 +23,24 @@
 #define BASE_SIZE 4
 
 extern void varray_init(varray_t* array) {
+    varray_init_arena(array, NULL);
+}
+
+extern void varray_init_arena(varray_t* array, arena_t* arena) {
     array->size = BASE_SIZE;
     array->length = 0;
-    array->values = array_alloc(value_t, BASE_SIZE);
+    array->arena = arena;
+    array->values = arena_array_alloc(arena, value_t, BASE_SIZE);
 }
 
 extern void varray_free(varray_t* array) {
-    free(array->values);
+    arena_array_free(array->arena, array->values);
 }
 
 extern void varray_push(varray_t* array, value_t value) {
     if (array->length == array->size) {
         array->size *= 2;
-        array_resize(value_t, array->values, array->size);
+        arena_array_resize(array->arena, value_t, array->values, array->length, array->size);
     }
 
     array->values[array->length++] = value;
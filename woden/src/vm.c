@@ -18,6 +18,8 @@
  */
 
 #include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 
@@ -28,37 +30,247 @@
 #include "debug.h"
 #include "table.h"
 #include "array.h"
+#include "gc.h"
+#include "registers.h"
+#include "parser.h"
 
 //#define DEBUG_TRACE_EXECUTION
 
-#define read_byte(vm) (*(vm)->current++)
-#define read_const(vm) ((vm)->chunk->constants.values[read_byte(vm)])
-#define read_string(vm) AS_STRING(read_const(vm))
+#ifndef FRAMES_SIZE
+#   define FRAMES_SIZE 1024
+#endif
+
+// How many innermost frames a runtime error reports before skipping to
+// the script.
+#define TRACE_FRAMES 16
+
+#define read_byte() (*current++)
+#define read_long() (current += 3, current[-3] | current[-2] << 8 | current[-1] << 16)
+#define read_short() (current += 2, current[-2] | current[-1] << 8)
+#define read_const() (constants[read_byte()])
+#define read_const_long() (constants[read_long()])
+#define read_string() AS_STRING(read_const())
+#define read_string_long() AS_STRING(read_const_long())
 
 #define pop(vm) stack_pop(&(vm)->stack)
 #define push(vm, x) stack_push(&(vm)->stack, x)
 #define peek(vm, i) (vm)->stack.current[-(i) - 1]
 
-#define binary_operation(vm, type, op) \
+#if defined(DEBUG_TRACE_EXECUTION)
+#   define trace_execution(vm) trace_operation(vm, current)
+#elif defined(WODEN_OPCODE_TRACE)
+#   define trace_execution(vm) putc(*current, (vm)->trace)
+#else
+#   define trace_execution(vm)
+#endif
+
+// Quickening rewrites the operation that is running into another form
+// of it. VMs on other threads may be running the same code, and both
+// forms do the same thing, so relaxed byte accesses are all it needs.
+#ifdef __GNUC__
+#   define read_operation() __atomic_load_n(current++, __ATOMIC_RELAXED)
+#   define rewrite(operation) __atomic_store_n(current - 1, (byte_t)(operation), __ATOMIC_RELAXED)
+#else
+#   define read_operation() read_byte()
+#   define rewrite(operation) (current[-1] = (byte_t)(operation))
+#endif
+
+#define quicken(vm, operation) \
+    do { \
+      rewrite(operation); \
+      ++(vm)->stats.quickened; \
+    } while (false)
+
+#define deopt(vm, operation) \
+    do { \
+      rewrite(operation); \
+      ++(vm)->stats.deopted; \
+    } while (false)
+
+#ifdef WODEN_COMPUTED_GOTO
+#   define dispatch(vm) \
+        trace_execution(vm); \
+        goto *operations[read_operation()]
+#   define vm_switch(vm) dispatch(vm);
+#   define vm_case(name) label_##name
+#   define vm_default label_unknown
+#   define vm_break(vm) dispatch(vm)
+#else
+#   define vm_switch(vm) \
+        trace_execution(vm); \
+        switch (read_operation())
+#   define vm_case(name) case name
+#   define vm_default default
+#   define vm_break(vm) break
+#endif
+
+#define vm_error(vm, ...) \
+    do { \
+      frame->current = current; \
+      runtime_error(vm, __VA_ARGS__); \
+      return VM_RUNTIME_ERROR; \
+    } while (false)
+
+#define binary_operation(vm, type, op, quick) \
     do { \
       if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) { \
-        runtime_error(vm, "Operands must be numbers."); \
-        return VM_RUNTIME_ERROR; \
+        vm_error(vm, "Operands must be numbers."); \
       } \
-      double b = AS_NUMBER(pop(vm)); \
-      double a = AS_NUMBER(pop(vm)); \
-      push(vm, type(a op b)); \
+      quicken(vm, quick); \
+      number_operation(vm, type, op); \
     } while (false)
 
-typedef struct vm vm_t;
+#define number_operation(vm, type, op) \
+    do { \
+      value_t y = pop(vm); \
+      peek(vm, 0) = type(AS_NUMBER(peek(vm, 0)) op AS_NUMBER(y)); \
+    } while (false)
 
-struct vm {
+// The form of an operation quickened for numbers. Anything else would
+// make the generic one fail too, so it raises the error and stays as
+// it is.
+#define quick_operation(vm, type, op) \
+    do { \
+      if (!ARE_NUMBERS(peek(vm, 0), peek(vm, 1))) { \
+        vm_error(vm, "Operands must be numbers."); \
+      } \
+      number_operation(vm, type, op); \
+    } while (false)
+
+#define add_operation(vm) \
+    do { \
+      if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) { \
+        concatinate(vm); \
+      } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) { \
+        double b = AS_NUMBER(pop(vm)); \
+        double a = AS_NUMBER(pop(vm)); \
+        push(vm, NUMBER_VAL(a + b)); \
+      } else { \
+        vm_error(vm, "Operands must be two numbers or two strings."); \
+      } \
+    } while (false)
+
+#define add_constant(vm, target, constant) \
+    do { \
+      value_t* value = target; \
+      value_t k = constant; \
+      if (IS_NUMBER(*value) && IS_NUMBER(k)) { \
+        *value = NUMBER_VAL(AS_NUMBER(*value) + AS_NUMBER(k)); \
+      } else { \
+        push(vm, *value); \
+        push(vm, k); \
+        add_operation(vm); \
+        *value = pop(vm); \
+      } \
+    } while (false)
+
+// The compiler only emits loop operations after a checked comparison,
+// for a counter and limit nothing else writes, so both are numbers.
+#define for_step(local, limit) \
+    do { \
+      double next = AS_NUMBER(*(local)) + AS_NUMBER(read_const()); \
+      size_t jump = read_short(); \
+      *(local) = NUMBER_VAL(next); \
+      if (next < (limit)) { \
+        current -= jump; \
+      } \
+    } while (false)
+
+#define slot(vm) (vm)->stack.values[read_byte()]
+#define NOT_BOOL_VAL(x) BOOL_VAL(!(x))
+
+#define register_operation(vm, type, op) \
+    do { \
+      value_t* target = &slot(vm); \
+      value_t x = slot(vm); \
+      value_t y = slot(vm); \
+      if (!IS_NUMBER(x) || !IS_NUMBER(y)) { \
+        vm_error(vm, "Operands must be numbers."); \
+      } \
+      *target = type(AS_NUMBER(x) op AS_NUMBER(y)); \
+    } while (false)
+
+#define define_global(vm, name) \
+    do { \
+      table_set(&(vm)->globals, name, peek(vm, 0)); \
+      pop(vm); \
+    } while (false)
+
+// Globals are looked up through an inline cache per name constant
+// (the pool is deduplicated, so that is every site naming the global).
+// A hit costs a version check and a load; any table change that can
+// move values bumps the version.
+#define resolve_global(vm, result, index) \
+    do { \
+      size_t at = index; \
+      table_cache_t* cache = &frame->caches[at]; \
+      if (cache->version == (vm)->globals.version) { \
+        result = cache->value; \
+      } else { \
+        string_t* key = AS_STRING(constants[at]); \
+        result = table_get(&(vm)->globals, key); \
+        if (result == NULL) { \
+          vm_error(vm, "Undefined variable '%s'.", key->target); \
+        } \
+        *cache = (table_cache_t) { result, (vm)->globals.version }; \
+      } \
+    } while (false)
+
+#define get_global(vm, index) \
+    do { \
+      value_t* value; \
+      resolve_global(vm, value, index); \
+      push(vm, *value); \
+    } while (false)
+
+#define set_global(vm, index) \
+    do { \
+      value_t* value; \
+      resolve_global(vm, value, index); \
+      *value = peek(vm, 0); \
+    } while (false)
+
+#define load_frame(vm) \
+    do { \
+      frame = &(vm)->frames[(vm)->frames_count - 1]; \
+      current = frame->current; \
+      constants = frame->constants; \
+      slots = (vm)->stack.values + frame->base; \
+    } while (false)
+
+typedef struct frame frame_t;
+
+// The script runs in a frame with no function. Slots are kept as an
+// offset, since the stack may move when a call grows it.
+struct frame {
+    function_t* function;
     chunk_t* chunk;
+    value_t* constants;
+    table_cache_t* caches;
     byte_t* current;
+    size_t base;
+};
+
+struct vm {
+    frame_t frames[FRAMES_SIZE];
+    size_t frames_count;
+    value_t* constants;
+    size_t constants_length;
+    table_cache_t* caches;
     stack_t stack;
     table_t globals;
+    vm_engine_t engine;
+    vm_stats_t stats;
+    vm_t* next;
+#ifdef WODEN_OPCODE_TRACE
+    FILE* trace;
+#endif
 };
 
+// Each thread has its own heap, so VMs only share roots with the other
+// VMs of their thread.
+static _Thread_local vm_t* vms = NULL;
+
 static bool is_falsey(value_t value) {
     return IS_NULL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
@@ -70,175 +282,878 @@ static void runtime_error(vm_t* vm, const char* format, ...) {
     va_end(args);
     fputs("\n", stdout);
 
-    size_t operation = vm->current - vm->chunk->code - 1;
-    size_t line = vm->chunk->lines[operation];
-    fprintf(stdout, "[line %zu] in script\n", line);
-    stack_init(&vm->stack);
+    for (size_t i = vm->frames_count; i > 0; --i) {
+        if (i == vm->frames_count - TRACE_FRAMES && i > 1) {
+            fprintf(stdout, "[%zu more frames]\n", i - 1);
+            i = 1;
+        }
+
+        frame_t* frame = &vm->frames[i - 1];
+        size_t operation = (size_t)(frame->current - frame->chunk->code) - 1;
+        fprintf(stdout, "[line %zu] in ", chunk_line(frame->chunk, operation));
+        if (frame->function == NULL) {
+            fprintf(stdout, "script\n");
+        } else {
+            fprintf(stdout, "%s()\n", frame->function->name->target);
+        }
+    }
+    stack_reset(&vm->stack);
+    vm->frames_count = 0;
+}
+
+#ifdef DEBUG_TRACE_EXECUTION
+static void trace_operation(vm_t* vm, byte_t* current) {
+    printf("          { ");
+    for (value_t* value = vm->stack.values; value < vm->stack.current; ++value) {
+        value_print(*value);
+        if (value < vm->stack.current - 1) {
+            printf(", ");
+        }
+    }
+    printf(" }");
+    printf("\n");
+    chunk_t* chunk = vm->frames[vm->frames_count - 1].chunk;
+    disassemble_operation(chunk, (size_t)(current - chunk->code));
+}
+#endif
+
+static void mark_vm(vm_t* vm) {
+    for (value_t* value = vm->stack.values; value < vm->stack.current; ++value) {
+        gc_mark_value(*value);
+    }
+    for (size_t i = 0; i < vm->constants_length; ++i) {
+        gc_mark_value(vm->constants[i]);
+    }
+    for (size_t i = 0; i < vm->frames_count; ++i) {
+        if (vm->frames[i].function != NULL) {
+            gc_mark_object(&vm->frames[i].function->object);
+        }
+    }
+    table_mark(&vm->globals);
+}
+
+// A collection started by one VM must keep the objects of every other
+// live VM on the thread as well.
+static void mark_roots(void* data) {
+    (void) data;
+    for (vm_t* vm = vms; vm != NULL; vm = vm->next) {
+        mark_vm(vm);
+    }
+}
+
+static bool call_value(vm_t* vm, value_t callee, size_t count) {
+    if (!IS_FUNCTION(callee)) {
+        runtime_error(vm, "Can only call functions.");
+        return false;
+    }
+
+    function_t* function = AS_FUNCTION(callee);
+    if (count != function->arity) {
+        runtime_error(vm, "Expected %zu arguments but got %zu.", function->arity, count);
+        return false;
+    }
+
+    if (vm->frames_count == FRAMES_SIZE || !stack_reserve(&vm->stack, function->body->depth)) {
+        runtime_error(vm, "Stack overflow.");
+        return false;
+    }
+
+    // Arguments stay where the caller pushed them and become the first
+    // slots of the new frame, after the callee itself.
+    size_t base = (size_t)(vm->stack.current - vm->stack.values) - count - 1;
+    vm->frames[vm->frames_count++] = (frame_t) {
+        function, function->body, function->constants, function->caches, function->body->code, base
+    };
+    return true;
+}
+
+// Replaces the running frame with a call to the function below the
+// arguments. Calls that would fail go through call_value() while the
+// frame is still there, so the error points at the caller.
+static bool tail_call(vm_t* vm, size_t count) {
+    value_t callee = peek(vm, count);
+    if (!IS_FUNCTION(callee) || AS_FUNCTION(callee)->arity != count) {
+        return call_value(vm, callee, count);
+    }
+
+    frame_t* frame = &vm->frames[--vm->frames_count];
+    value_t* slots = vm->stack.values + frame->base;
+    memmove(slots, vm->stack.current - count - 1, (count + 1) * sizeof(value_t));
+    vm->stack.current = slots + count + 1;
+    return call_value(vm, callee, count);
 }
 
 static void concatinate(vm_t* vm) {
     string_t* y = AS_STRING(pop(vm));
     string_t* x = AS_STRING(pop(vm));
+    push(vm, OBJECT_VAL(string_concat(x, y)));
 
-    size_t size = x->size + y->size;
-    char* target = array_alloc(char, size + 1);
-    memcpy(target, x->target, x->size);
-    memcpy(target + x->size, y->target, y->size);
-    target[size] = '\0';
-
-    push(vm, OBJECT_VAL(string_make(target, size)));
+    if (gc_pending()) {
+        gc_collect(mark_roots, vm);
+    }
 }
 
 static vm_result_t interpret(vm_t* vm) {
-    byte_t operation;
-    while (true) {
-
-#ifdef DEBUG_TRACE_EXECUTION
-        printf("          { ");
-        for (value_t* current = vm->stack.values; current < vm->stack.current; ++current) {
-            value_print(*current);
-            if (current < vm->stack.current - 1) {
-                printf(", ");
-            }
-        }
-        printf(" }");
-        printf("\n");
-        disassemble_operation(vm->chunk, (size_t)(vm->current - vm->chunk->code));
+#ifdef WODEN_COMPUTED_GOTO
+    static void* operations[] = {
+        [0 ... UINT8_MAX] = &&vm_default,
+        [OP_CONSTANT] = &&vm_case(OP_CONSTANT),
+        [OP_CONSTANT_LONG] = &&vm_case(OP_CONSTANT_LONG),
+        [OP_NULL] = &&vm_case(OP_NULL),
+        [OP_TRUE] = &&vm_case(OP_TRUE),
+        [OP_FALSE] = &&vm_case(OP_FALSE),
+        [OP_NOT] = &&vm_case(OP_NOT),
+        [OP_NEGATE] = &&vm_case(OP_NEGATE),
+        [OP_DIVIDE] = &&vm_case(OP_DIVIDE),
+        [OP_MULTIPLY] = &&vm_case(OP_MULTIPLY),
+        [OP_MODULO] = &&vm_case(OP_MODULO),
+        [OP_SUBTRACT] = &&vm_case(OP_SUBTRACT),
+        [OP_ADD] = &&vm_case(OP_ADD),
+        [OP_EQUAL] = &&vm_case(OP_EQUAL),
+        [OP_NOT_EQUAL] = &&vm_case(OP_NOT_EQUAL),
+        [OP_LESS] = &&vm_case(OP_LESS),
+        [OP_LESS_EQUAL] = &&vm_case(OP_LESS_EQUAL),
+        [OP_GREATER] = &&vm_case(OP_GREATER),
+        [OP_GREATER_EQUAL] = &&vm_case(OP_GREATER_EQUAL),
+        [OP_AND] = &&vm_case(OP_AND),
+        [OP_OR] = &&vm_case(OP_OR),
+        [OP_PRINT] = &&vm_case(OP_PRINT),
+        [OP_POP] = &&vm_case(OP_POP),
+        [OP_DEFINE_GLOBAL] = &&vm_case(OP_DEFINE_GLOBAL),
+        [OP_DEFINE_GLOBAL_LONG] = &&vm_case(OP_DEFINE_GLOBAL_LONG),
+        [OP_GET_GLOBAL] = &&vm_case(OP_GET_GLOBAL),
+        [OP_GET_GLOBAL_LONG] = &&vm_case(OP_GET_GLOBAL_LONG),
+        [OP_SET_GLOBAL] = &&vm_case(OP_SET_GLOBAL),
+        [OP_SET_GLOBAL_LONG] = &&vm_case(OP_SET_GLOBAL_LONG),
+        [OP_GET_LOCAL] = &&vm_case(OP_GET_LOCAL),
+        [OP_SET_LOCAL] = &&vm_case(OP_SET_LOCAL),
+        [OP_ADD_LOCALS] = &&vm_case(OP_ADD_LOCALS),
+        [OP_LESS_LOCAL_CONSTANT] = &&vm_case(OP_LESS_LOCAL_CONSTANT),
+        [OP_ADD_LOCAL_CONSTANT] = &&vm_case(OP_ADD_LOCAL_CONSTANT),
+        [OP_ADD_GLOBAL_CONSTANT] = &&vm_case(OP_ADD_GLOBAL_CONSTANT),
+        [OP_JUMP] = &&vm_case(OP_JUMP),
+        [OP_JUMP_IF_FALSE] = &&vm_case(OP_JUMP_IF_FALSE),
+        [OP_LOOP] = &&vm_case(OP_LOOP),
+        [OP_FOR_LESS_CONSTANT] = &&vm_case(OP_FOR_LESS_CONSTANT),
+        [OP_FOR_LESS_LOCAL] = &&vm_case(OP_FOR_LESS_LOCAL),
+        [OP_ADD_NUM] = &&vm_case(OP_ADD_NUM),
+        [OP_ADD_ANY] = &&vm_case(OP_ADD_ANY),
+        [OP_SUBTRACT_NUM] = &&vm_case(OP_SUBTRACT_NUM),
+        [OP_MULTIPLY_NUM] = &&vm_case(OP_MULTIPLY_NUM),
+        [OP_DIVIDE_NUM] = &&vm_case(OP_DIVIDE_NUM),
+        [OP_LESS_NUM] = &&vm_case(OP_LESS_NUM),
+        [OP_LESS_EQUAL_NUM] = &&vm_case(OP_LESS_EQUAL_NUM),
+        [OP_GREATER_NUM] = &&vm_case(OP_GREATER_NUM),
+        [OP_GREATER_EQUAL_NUM] = &&vm_case(OP_GREATER_EQUAL_NUM),
+        [OP_CALL] = &&vm_case(OP_CALL),
+        [OP_TAIL_CALL] = &&vm_case(OP_TAIL_CALL),
+        [OP_RETURN] = &&vm_case(OP_RETURN)
+    };
 #endif
 
-        switch (operation = read_byte(vm)) {
-            case OP_CONSTANT: {
-                push(vm, read_const(vm));
-                break;
+    frame_t* frame;
+    byte_t* current;
+    value_t* constants;
+    value_t* slots;
+    load_frame(vm);
+    while (true) {
+        vm_switch(vm) {
+            vm_case(OP_CONSTANT): {
+                push(vm, read_const());
+                vm_break(vm);
             }
-            case OP_NULL: {
+            vm_case(OP_CONSTANT_LONG): {
+                push(vm, read_const_long());
+                vm_break(vm);
+            }
+            vm_case(OP_NULL): {
                 push(vm, NULL_VAL);
-                break;
+                vm_break(vm);
             }
-            case OP_TRUE: {
+            vm_case(OP_TRUE): {
                 push(vm, BOOL_VAL(true));
-                break;
+                vm_break(vm);
             }
-            case OP_FALSE: {
+            vm_case(OP_FALSE): {
                 push(vm, BOOL_VAL(false));
-                break;
+                vm_break(vm);
             }
-            case OP_NOT: {
+            vm_case(OP_NOT): {
                 push(vm, BOOL_VAL(is_falsey(pop(vm))));
-                break;
+                vm_break(vm);
             }
-            case OP_EQUAL: {
+            vm_case(OP_EQUAL): {
                 value_t y = pop(vm);
                 value_t x = pop(vm);
                 push(vm, BOOL_VAL(value_equal(x, y)));
-                break;
+                vm_break(vm);
             }
-            case OP_NOT_EQUAL: {
+            vm_case(OP_NOT_EQUAL): {
                 value_t y = pop(vm);
                 value_t x = pop(vm);
                 push(vm, BOOL_VAL(!value_equal(x, y)));
-                break;
+                vm_break(vm);
             }
-            case OP_GREATER: {
-                binary_operation(vm, BOOL_VAL, >);
-                break;
+            vm_case(OP_GREATER): {
+                binary_operation(vm, BOOL_VAL, >, OP_GREATER_NUM);
+                vm_break(vm);
             }
-            case OP_GREATER_EQUAL: {
-                binary_operation(vm, BOOL_VAL, <);
-                push(vm, BOOL_VAL(is_falsey(pop(vm))));
-                break;
+            vm_case(OP_GREATER_EQUAL): {
+                binary_operation(vm, NOT_BOOL_VAL, <, OP_GREATER_EQUAL_NUM);
+                vm_break(vm);
             }
-            case OP_LESS: {
-                binary_operation(vm, BOOL_VAL, <);
-                break;
+            vm_case(OP_LESS): {
+                binary_operation(vm, BOOL_VAL, <, OP_LESS_NUM);
+                vm_break(vm);
             }
-            case OP_LESS_EQUAL: {
-                binary_operation(vm, BOOL_VAL, >);
-                push(vm, BOOL_VAL(is_falsey(pop(vm))));
-                break;
+            vm_case(OP_LESS_EQUAL): {
+                binary_operation(vm, NOT_BOOL_VAL, >, OP_LESS_EQUAL_NUM);
+                vm_break(vm);
             }
-            case OP_NEGATE: {
+            vm_case(OP_NEGATE): {
                 if (!IS_NUMBER(peek(vm, 0))) {
-                    runtime_error(vm, "Operand must be a number.");
-                    return VM_RUNTIME_ERROR;
+                    vm_error(vm, "Operand must be a number.");
                 }
                 push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
-                break;
-            }
-            case OP_ADD: {
-                if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
-                    concatinate(vm);
-                } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
-                    double y = AS_NUMBER(pop(vm));
-                    double x = AS_NUMBER(pop(vm));
-                    push(vm, NUMBER_VAL(x + y));
+                vm_break(vm);
+            }
+            vm_case(OP_ADD): {
+                if (ARE_NUMBERS(peek(vm, 0), peek(vm, 1))) {
+                    quicken(vm, OP_ADD_NUM);
+                }
+                add_operation(vm);
+                vm_break(vm);
+            }
+            vm_case(OP_SUBTRACT): {
+                binary_operation(vm, NUMBER_VAL, -, OP_SUBTRACT_NUM);
+                vm_break(vm);
+            }
+            vm_case(OP_MULTIPLY): {
+                binary_operation(vm, NUMBER_VAL, *, OP_MULTIPLY_NUM);
+                vm_break(vm);
+            }
+            vm_case(OP_DIVIDE): {
+                binary_operation(vm, NUMBER_VAL, /, OP_DIVIDE_NUM);
+                vm_break(vm);
+            }
+            vm_case(OP_ADD_NUM): {
+                if (ARE_NUMBERS(peek(vm, 0), peek(vm, 1))) {
+                    number_operation(vm, NUMBER_VAL, +);
                 } else {
-                    runtime_error(vm, "Operands must be two numbers or two strings.");
-                    return VM_RUNTIME_ERROR;
+                    // A site that has seen both kinds of operands would
+                    // keep flipping between forms, rewriting code that
+                    // other threads share, so it settles on OP_ADD_ANY.
+                    deopt(vm, OP_ADD_ANY);
+                    add_operation(vm);
                 }
-                break;
+                vm_break(vm);
+            }
+            vm_case(OP_ADD_ANY): {
+                add_operation(vm);
+                vm_break(vm);
+            }
+            vm_case(OP_SUBTRACT_NUM): {
+                quick_operation(vm, NUMBER_VAL, -);
+                vm_break(vm);
+            }
+            vm_case(OP_MULTIPLY_NUM): {
+                quick_operation(vm, NUMBER_VAL, *);
+                vm_break(vm);
             }
-            case OP_SUBTRACT: {
-                binary_operation(vm, NUMBER_VAL, -);
-                break;
+            vm_case(OP_DIVIDE_NUM): {
+                quick_operation(vm, NUMBER_VAL, /);
+                vm_break(vm);
             }
-            case OP_MULTIPLY: {
-                binary_operation(vm, NUMBER_VAL, *);
-                break;
+            vm_case(OP_LESS_NUM): {
+                quick_operation(vm, BOOL_VAL, <);
+                vm_break(vm);
+            }
+            vm_case(OP_LESS_EQUAL_NUM): {
+                quick_operation(vm, NOT_BOOL_VAL, >);
+                vm_break(vm);
+            }
+            vm_case(OP_GREATER_NUM): {
+                quick_operation(vm, BOOL_VAL, >);
+                vm_break(vm);
+            }
+            vm_case(OP_GREATER_EQUAL_NUM): {
+                quick_operation(vm, NOT_BOOL_VAL, <);
+                vm_break(vm);
+            }
+            vm_case(OP_MODULO): {
+                if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) {
+                    vm_error(vm, "Operands must be numbers.");
+                }
+                double b = AS_NUMBER(pop(vm));
+                double a = AS_NUMBER(pop(vm));
+                push(vm, NUMBER_VAL(fmod(a, b)));
+                vm_break(vm);
+            }
+            vm_case(OP_AND): {
+                value_t y = pop(vm);
+                if (!is_falsey(peek(vm, 0))) {
+                    peek(vm, 0) = y;
+                }
+                vm_break(vm);
             }
-            case OP_DIVIDE: {
-                binary_operation(vm, NUMBER_VAL, /);
-                break;
+            vm_case(OP_OR): {
+                value_t y = pop(vm);
+                if (is_falsey(peek(vm, 0))) {
+                    peek(vm, 0) = y;
+                }
+                vm_break(vm);
             }
-            case OP_PRINT: {
+            vm_case(OP_PRINT): {
                 value_print(pop(vm));
                 printf("\n");
-                break;
+                vm_break(vm);
             }
-            case OP_POP: {
+            vm_case(OP_POP): {
                 pop(vm);
-                break;
+                vm_break(vm);
             }
-            case OP_DEFINE_GLOBAL: {
-                string_t* name = read_string(vm);
-                table_set(&vm->globals, name, peek(vm, 0));
-                pop(vm);
-                break;
+            vm_case(OP_DEFINE_GLOBAL): {
+                define_global(vm, read_string());
+                vm_break(vm);
+            }
+            vm_case(OP_DEFINE_GLOBAL_LONG): {
+                define_global(vm, read_string_long());
+                vm_break(vm);
+            }
+            vm_case(OP_GET_GLOBAL): {
+                get_global(vm, read_byte());
+                vm_break(vm);
+            }
+            vm_case(OP_GET_GLOBAL_LONG): {
+                get_global(vm, read_long());
+                vm_break(vm);
+            }
+            vm_case(OP_SET_GLOBAL): {
+                set_global(vm, read_byte());
+                vm_break(vm);
+            }
+            vm_case(OP_SET_GLOBAL_LONG): {
+                set_global(vm, read_long());
+                vm_break(vm);
+            }
+            vm_case(OP_GET_LOCAL): {
+                push(vm, slots[read_byte()]);
+                vm_break(vm);
+            }
+            vm_case(OP_SET_LOCAL): {
+                slots[read_byte()] = peek(vm, 0);
+                vm_break(vm);
+            }
+            vm_case(OP_ADD_LOCALS): {
+                push(vm, slots[read_byte()]);
+                push(vm, slots[read_byte()]);
+                add_operation(vm);
+                vm_break(vm);
+            }
+            vm_case(OP_LESS_LOCAL_CONSTANT): {
+                value_t x = slots[read_byte()];
+                value_t y = read_const();
+                if (!IS_NUMBER(x) || !IS_NUMBER(y)) {
+                    vm_error(vm, "Operands must be numbers.");
+                }
+                push(vm, BOOL_VAL(AS_NUMBER(x) < AS_NUMBER(y)));
+                vm_break(vm);
+            }
+            vm_case(OP_ADD_LOCAL_CONSTANT): {
+                value_t* local = &slots[read_byte()];
+                add_constant(vm, local, read_const());
+                vm_break(vm);
+            }
+            vm_case(OP_ADD_GLOBAL_CONSTANT): {
+                value_t* global;
+                resolve_global(vm, global, read_byte());
+                add_constant(vm, global, read_const());
+                vm_break(vm);
             }
-            case OP_GET_GLOBAL: {
-                string_t* name = read_string(vm);
-                value_t* value = table_get(&vm->globals, name);
-                if (value == NULL) {
-                    runtime_error(vm, "Undefined variable '%s'.", name->target);
+            vm_case(OP_JUMP): {
+                size_t jump = read_short();
+                current += jump;
+                vm_break(vm);
+            }
+            vm_case(OP_JUMP_IF_FALSE): {
+                size_t jump = read_short();
+                if (is_falsey(peek(vm, 0))) {
+                    current += jump;
+                }
+                vm_break(vm);
+            }
+            vm_case(OP_LOOP): {
+                size_t jump = read_short();
+                current -= jump;
+                vm_break(vm);
+            }
+            vm_case(OP_FOR_LESS_CONSTANT): {
+                value_t* local = &slots[read_byte()];
+                double limit = AS_NUMBER(read_const());
+                for_step(local, limit);
+                vm_break(vm);
+            }
+            vm_case(OP_FOR_LESS_LOCAL): {
+                value_t* local = &slots[read_byte()];
+                double limit = AS_NUMBER(slots[read_byte()]);
+                for_step(local, limit);
+                vm_break(vm);
+            }
+            vm_case(OP_CALL): {
+                size_t count = read_byte();
+                frame->current = current;
+                if (!call_value(vm, peek(vm, count), count)) {
                     return VM_RUNTIME_ERROR;
                 }
-                push(vm, *value);
-                break;
+                load_frame(vm);
+                vm_break(vm);
             }
-            case OP_SET_GLOBAL: {
-                string_t* name = read_string(vm);
-                value_t* value = table_get(&vm->globals, name);
-                if (value == NULL) {
-                    runtime_error(vm, "Undefined variable '%s'.", name->target);
+            vm_case(OP_TAIL_CALL): {
+                size_t count = read_byte();
+                frame->current = current;
+                if (!tail_call(vm, count)) {
                     return VM_RUNTIME_ERROR;
                 }
-                *value = peek(vm, 0);
-                break;
+                load_frame(vm);
+                vm_break(vm);
+            }
+            vm_case(OP_RETURN): {
+                if (frame->function == NULL) {
+                    frame->current = current;
+                    return VM_SUCCESS;
+                }
+
+                value_t result = pop(vm);
+                vm->stack.current = slots;
+                push(vm, result);
+                if (--vm->frames_count == 0) {
+                    return VM_SUCCESS;
+                }
+                load_frame(vm);
+                vm_break(vm);
             }
-            case OP_RETURN: {
+            vm_default: {
+                vm_error(vm, "Unknown operation.");
+            }
+        }
+    }
+}
+
+// Same semantics as interpret(), over register code. The whole stack
+// array is the frame, so every slot is a GC root.
+static vm_result_t interpret_registers(vm_t* vm) {
+#ifdef WODEN_COMPUTED_GOTO
+    static void* operations[] = {
+        [0 ... UINT8_MAX] = &&vm_default,
+        [REG_CONSTANT] = &&vm_case(REG_CONSTANT),
+        [REG_CONSTANT_LONG] = &&vm_case(REG_CONSTANT_LONG),
+        [REG_NULL] = &&vm_case(REG_NULL),
+        [REG_TRUE] = &&vm_case(REG_TRUE),
+        [REG_FALSE] = &&vm_case(REG_FALSE),
+        [REG_MOVE] = &&vm_case(REG_MOVE),
+        [REG_NOT] = &&vm_case(REG_NOT),
+        [REG_NEGATE] = &&vm_case(REG_NEGATE),
+        [REG_DIVIDE] = &&vm_case(REG_DIVIDE),
+        [REG_MULTIPLY] = &&vm_case(REG_MULTIPLY),
+        [REG_MODULO] = &&vm_case(REG_MODULO),
+        [REG_SUBTRACT] = &&vm_case(REG_SUBTRACT),
+        [REG_ADD] = &&vm_case(REG_ADD),
+        [REG_EQUAL] = &&vm_case(REG_EQUAL),
+        [REG_NOT_EQUAL] = &&vm_case(REG_NOT_EQUAL),
+        [REG_LESS] = &&vm_case(REG_LESS),
+        [REG_LESS_EQUAL] = &&vm_case(REG_LESS_EQUAL),
+        [REG_GREATER] = &&vm_case(REG_GREATER),
+        [REG_GREATER_EQUAL] = &&vm_case(REG_GREATER_EQUAL),
+        [REG_AND] = &&vm_case(REG_AND),
+        [REG_OR] = &&vm_case(REG_OR),
+        [REG_PRINT] = &&vm_case(REG_PRINT),
+        [REG_DEFINE_GLOBAL] = &&vm_case(REG_DEFINE_GLOBAL),
+        [REG_DEFINE_GLOBAL_LONG] = &&vm_case(REG_DEFINE_GLOBAL_LONG),
+        [REG_GET_GLOBAL] = &&vm_case(REG_GET_GLOBAL),
+        [REG_GET_GLOBAL_LONG] = &&vm_case(REG_GET_GLOBAL_LONG),
+        [REG_SET_GLOBAL] = &&vm_case(REG_SET_GLOBAL),
+        [REG_SET_GLOBAL_LONG] = &&vm_case(REG_SET_GLOBAL_LONG),
+        [REG_JUMP] = &&vm_case(REG_JUMP),
+        [REG_JUMP_IF_FALSE] = &&vm_case(REG_JUMP_IF_FALSE),
+        [REG_LOOP] = &&vm_case(REG_LOOP),
+        [REG_FOR_LESS_CONSTANT] = &&vm_case(REG_FOR_LESS_CONSTANT),
+        [REG_FOR_LESS_LOCAL] = &&vm_case(REG_FOR_LESS_LOCAL),
+        [REG_RETURN] = &&vm_case(REG_RETURN)
+    };
+#endif
+
+    frame_t* frame = &vm->frames[0];
+    byte_t* current = frame->current;
+    value_t* constants = frame->constants;
+
+    for (size_t i = 0; i < REGISTERS_SIZE; ++i) {
+        vm->stack.values[i] = NULL_VAL;
+    }
+    vm->stack.current = vm->stack.values + REGISTERS_SIZE;
+
+    while (true) {
+        vm_switch(vm) {
+            vm_case(REG_CONSTANT): {
+                value_t* target = &slot(vm);
+                *target = read_const();
+                vm_break(vm);
+            }
+            vm_case(REG_CONSTANT_LONG): {
+                value_t* target = &slot(vm);
+                *target = read_const_long();
+                vm_break(vm);
+            }
+            vm_case(REG_NULL): {
+                slot(vm) = NULL_VAL;
+                vm_break(vm);
+            }
+            vm_case(REG_TRUE): {
+                slot(vm) = BOOL_VAL(true);
+                vm_break(vm);
+            }
+            vm_case(REG_FALSE): {
+                slot(vm) = BOOL_VAL(false);
+                vm_break(vm);
+            }
+            vm_case(REG_MOVE): {
+                value_t* target = &slot(vm);
+                *target = slot(vm);
+                vm_break(vm);
+            }
+            vm_case(REG_NOT): {
+                value_t* target = &slot(vm);
+                *target = BOOL_VAL(is_falsey(slot(vm)));
+                vm_break(vm);
+            }
+            vm_case(REG_NEGATE): {
+                value_t* target = &slot(vm);
+                value_t x = slot(vm);
+                if (!IS_NUMBER(x)) {
+                    vm_error(vm, "Operand must be a number.");
+                }
+                *target = NUMBER_VAL(-AS_NUMBER(x));
+                vm_break(vm);
+            }
+            vm_case(REG_DIVIDE): {
+                register_operation(vm, NUMBER_VAL, /);
+                vm_break(vm);
+            }
+            vm_case(REG_MULTIPLY): {
+                register_operation(vm, NUMBER_VAL, *);
+                vm_break(vm);
+            }
+            vm_case(REG_MODULO): {
+                value_t* target = &slot(vm);
+                value_t x = slot(vm);
+                value_t y = slot(vm);
+                if (!IS_NUMBER(x) || !IS_NUMBER(y)) {
+                    vm_error(vm, "Operands must be numbers.");
+                }
+                *target = NUMBER_VAL(fmod(AS_NUMBER(x), AS_NUMBER(y)));
+                vm_break(vm);
+            }
+            vm_case(REG_SUBTRACT): {
+                register_operation(vm, NUMBER_VAL, -);
+                vm_break(vm);
+            }
+            vm_case(REG_ADD): {
+                value_t* target = &slot(vm);
+                value_t x = slot(vm);
+                value_t y = slot(vm);
+                if (IS_NUMBER(x) && IS_NUMBER(y)) {
+                    *target = NUMBER_VAL(AS_NUMBER(x) + AS_NUMBER(y));
+                } else if (IS_STRING(x) && IS_STRING(y)) {
+                    *target = OBJECT_VAL(string_concat(AS_STRING(x), AS_STRING(y)));
+                    if (gc_pending()) {
+                        gc_collect(mark_roots, vm);
+                    }
+                } else {
+                    vm_error(vm, "Operands must be two numbers or two strings.");
+                }
+                vm_break(vm);
+            }
+            vm_case(REG_EQUAL): {
+                value_t* target = &slot(vm);
+                value_t x = slot(vm);
+                *target = BOOL_VAL(value_equal(x, slot(vm)));
+                vm_break(vm);
+            }
+            vm_case(REG_NOT_EQUAL): {
+                value_t* target = &slot(vm);
+                value_t x = slot(vm);
+                *target = BOOL_VAL(!value_equal(x, slot(vm)));
+                vm_break(vm);
+            }
+            vm_case(REG_LESS): {
+                register_operation(vm, BOOL_VAL, <);
+                vm_break(vm);
+            }
+            vm_case(REG_LESS_EQUAL): {
+                register_operation(vm, NOT_BOOL_VAL, >);
+                vm_break(vm);
+            }
+            vm_case(REG_GREATER): {
+                register_operation(vm, BOOL_VAL, >);
+                vm_break(vm);
+            }
+            vm_case(REG_GREATER_EQUAL): {
+                register_operation(vm, NOT_BOOL_VAL, <);
+                vm_break(vm);
+            }
+            vm_case(REG_AND): {
+                value_t* target = &slot(vm);
+                value_t x = slot(vm);
+                value_t y = slot(vm);
+                *target = is_falsey(x) ? x : y;
+                vm_break(vm);
+            }
+            vm_case(REG_OR): {
+                value_t* target = &slot(vm);
+                value_t x = slot(vm);
+                value_t y = slot(vm);
+                *target = is_falsey(x) ? y : x;
+                vm_break(vm);
+            }
+            vm_case(REG_PRINT): {
+                value_print(slot(vm));
+                printf("\n");
+                vm_break(vm);
+            }
+            vm_case(REG_DEFINE_GLOBAL): {
+                string_t* name = read_string();
+                table_set(&vm->globals, name, slot(vm));
+                vm_break(vm);
+            }
+            vm_case(REG_DEFINE_GLOBAL_LONG): {
+                string_t* name = read_string_long();
+                table_set(&vm->globals, name, slot(vm));
+                vm_break(vm);
+            }
+            vm_case(REG_GET_GLOBAL): {
+                value_t* target = &slot(vm);
+                value_t* value;
+                resolve_global(vm, value, read_byte());
+                *target = *value;
+                vm_break(vm);
+            }
+            vm_case(REG_GET_GLOBAL_LONG): {
+                value_t* target = &slot(vm);
+                value_t* value;
+                resolve_global(vm, value, read_long());
+                *target = *value;
+                vm_break(vm);
+            }
+            vm_case(REG_SET_GLOBAL): {
+                value_t* value;
+                resolve_global(vm, value, read_byte());
+                *value = slot(vm);
+                vm_break(vm);
+            }
+            vm_case(REG_SET_GLOBAL_LONG): {
+                value_t* value;
+                resolve_global(vm, value, read_long());
+                *value = slot(vm);
+                vm_break(vm);
+            }
+            vm_case(REG_JUMP): {
+                size_t jump = read_short();
+                current += jump;
+                vm_break(vm);
+            }
+            vm_case(REG_JUMP_IF_FALSE): {
+                value_t x = slot(vm);
+                size_t jump = read_short();
+                if (is_falsey(x)) {
+                    current += jump;
+                }
+                vm_break(vm);
+            }
+            vm_case(REG_LOOP): {
+                size_t jump = read_short();
+                current -= jump;
+                vm_break(vm);
+            }
+            vm_case(REG_FOR_LESS_CONSTANT): {
+                value_t* local = &slot(vm);
+                double limit = AS_NUMBER(read_const());
+                for_step(local, limit);
+                vm_break(vm);
+            }
+            vm_case(REG_FOR_LESS_LOCAL): {
+                value_t* local = &slot(vm);
+                double limit = AS_NUMBER(slot(vm));
+                for_step(local, limit);
+                vm_break(vm);
+            }
+            vm_case(REG_RETURN): {
+                frame->current = current;
                 return VM_SUCCESS;
             }
+            vm_default: {
+                vm_error(vm, "Unknown operation.");
+            }
+        }
+    }
+}
+
+extern vm_t* vm_create(vm_engine_t engine) {
+    vm_t* vm = calloc(1, sizeof(vm_t));
+    vm->engine = engine;
+    stack_init(&vm->stack, STACK_LIMIT);
+    table_init(&vm->globals);
+
+#ifdef WODEN_OPCODE_TRACE
+    const char* trace = getenv("WODEN_TRACE");
+    vm->trace = fopen(trace != NULL ? trace : "woden.trace", "wb");
+    if (vm->trace == NULL) {
+        vm->trace = fopen("/dev/null", "wb");
+    }
+#endif
+
+    vm->next = vms;
+    vms = vm;
+    return vm;
+}
+
+extern void vm_destroy(vm_t* vm) {
+    vm_t** link = &vms;
+    while (*link != vm) {
+        link = &(*link)->next;
+    }
+    *link = vm->next;
+
+#ifdef WODEN_OPCODE_TRACE
+    fclose(vm->trace);
+#endif
+    stack_free(&vm->stack);
+    table_free(&vm->globals);
+    free(vm->constants);
+    free(vm->caches);
+    free(vm);
+}
+
+extern vm_result_t vm_interpret(vm_t* vm, const char* source) {
+    chunk_t chunk;
+    chunk_init(&chunk);
+
+    vm_result_t result = VM_SYNTAX_ERROR;
+    if (parser_parse(&chunk, source, false)) {
+        result = vm_execute(vm, &chunk);
+    }
+    chunk_free(&chunk);
+    return result;
+}
+
+// Only quickening writes to a running chunk, so VMs on several threads
+// can execute the same one. Its strings belong to the heap of the thread
+// that compiled it, so each VM works on copies interned in its own heap.
+static void load_constants(vm_t* vm, chunk_t* chunk) {
+    size_t length = chunk->constants.length;
+    vm->constants = realloc(vm->constants, (length + 1) * sizeof(value_t));
+    vm->constants_length = 0;
+    for (size_t i = 0; i < length; ++i) {
+        value_t value = chunk->constants.values[i];
+        if (IS_STRING(value)) {
+            value = OBJECT_VAL(string_copy(AS_CSTRING(value), AS_STRING(value)->size));
+        } else if (IS_FUNCTION(value) && AS_FUNCTION(value)->heap != gc_heap()) {
+            value = OBJECT_VAL(function_copy(AS_FUNCTION(value)));
+        }
+        vm->constants[vm->constants_length++] = value;
+    }
+
+    // Cache slots are indexed by constant, so they only make sense for
+    // the chunk they were filled from.
+    free(vm->caches);
+    vm->caches = calloc(length + 1, sizeof(table_cache_t));
+}
+
+extern vm_result_t vm_execute(vm_t* vm, chunk_t* chunk) {
+    load_constants(vm, chunk);
+
+    chunk_t registers;
+    vm_engine_t engine = vm->engine;
+    if (engine == VM_REGISTERS) {
+        chunk_init(&registers);
+        if (registers_compile(&registers, chunk)) {
+            chunk = &registers;
+        } else {
+            ++vm->stats.fallbacks;
+            chunk_free(&registers);
+            engine = VM_STACK;
         }
     }
+
+    vm->frames[0] = (frame_t) { NULL, chunk, vm->constants, vm->caches, chunk->code, 0 };
+    vm->frames_count = 1;
+    stack_reset(&vm->stack);
+
+    vm_result_t result = VM_RUNTIME_ERROR;
+    size_t depth = engine == VM_REGISTERS ? REGISTERS_SIZE : chunk->depth;
+    if (!stack_reserve(&vm->stack, depth)) {
+        fprintf(stdout, "Stack overflow.\n[line %zu] in script\n", chunk_line(chunk, 0));
+    } else {
+        result = engine == VM_REGISTERS ? interpret_registers(vm) : interpret(vm);
+    }
+
+    stack_reset(&vm->stack);
+    vm->frames_count = 0;
+    vm->constants_length = 0;
+    if (engine == VM_REGISTERS) {
+        chunk_free(&registers);
+    }
+    return result;
 }
 
-extern vm_result_t vm_run(chunk_t* chunk) {
-    vm_t vm = { chunk, chunk->code };
-    stack_init(&vm.stack);
-    table_init(&vm.globals);
+extern vm_result_t vm_call(vm_t* vm, const char* name, value_t* args, size_t count, value_t* result) {
+    value_t callee;
+    if (!vm_get_global(vm, name, &callee)) {
+        fprintf(stdout, "Undefined function '%s'.\n", name);
+        return VM_RUNTIME_ERROR;
+    }
 
-    vm_result_t result = interpret(&vm);
+    stack_reset(&vm->stack);
+    if (!stack_reserve(&vm->stack, count + 1)) {
+        fprintf(stdout, "Stack overflow.\n");
+        return VM_RUNTIME_ERROR;
+    }
+
+    push(vm, callee);
+    for (size_t i = 0; i < count; ++i) {
+        push(vm, args[i]);
+    }
+    if (!call_value(vm, callee, count)) {
+        return VM_RUNTIME_ERROR;
+    }
+
+    vm_result_t status = interpret(vm);
+    if (status == VM_SUCCESS) {
+        *result = pop(vm);
+    }
+    stack_reset(&vm->stack);
+    return status;
+}
+
+extern bool vm_get_global(vm_t* vm, const char* name, value_t* value) {
+    value_t* global = table_get(&vm->globals, string_copy(name, strlen(name)));
+    if (global == NULL) {
+        return false;
+    }
+
+    *value = *global;
+    return true;
+}
+
+extern void vm_set_global(vm_t* vm, const char* name, value_t value) {
+    table_set(&vm->globals, string_copy(name, strlen(name)), value);
+}
+
+extern vm_stats_t vm_stats(vm_t* vm) {
+    return vm->stats;
+}
 
-    table_free(&vm.globals);
+extern vm_result_t vm_run(chunk_t* chunk, vm_engine_t engine) {
+    vm_t* vm = vm_create(engine);
+    vm_result_t result = vm_execute(vm, chunk);
+    vm_destroy(vm);
     return result;
 }
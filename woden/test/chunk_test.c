@@ -0,0 +1,251 @@
+/* VArray Test - Tests for VArray
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "test.h"
+#include "chunk.h"
+#include "object.h"
+#include "serial.h"
+#include "parser.h"
+#include "vm.h"
+
+#define TEST_PATH "/chunk"
+
+#define foreach(index, from, to) \
+    for (size_t index = from; index < to; ++index)
+
+static void test_lines(void);
+static void test_constants(void);
+static void test_depth(void);
+static void test_serial(void);
+static void test_optimize(void);
+static void test_optimize_results(void);
+static void test_counted_loops(void);
+
+extern void add_chunk_tests(void) {
+    g_test_add_func(TEST_PATH "/lines", test_lines);
+    g_test_add_func(TEST_PATH "/constants", test_constants);
+    g_test_add_func(TEST_PATH "/depth", test_depth);
+    g_test_add_func(TEST_PATH "/serial", test_serial);
+    g_test_add_func(TEST_PATH "/optimize", test_optimize);
+    g_test_add_func(TEST_PATH "/optimize/results", test_optimize_results);
+    g_test_add_func(TEST_PATH "/optimize/counted_loops", test_counted_loops);
+}
+
+static void test_lines(void) {
+    chunk_t chunk;
+    size_t lines[] = { 1, 1, 1, 2, 4, 4, 7, 7, 7, 7, 8 };
+    size_t count = sizeof(lines) / sizeof(lines[0]);
+
+    chunk_init(&chunk);
+    foreach(i, 0, count) {
+        chunk_write(&chunk, OP_POP, lines[i]);
+    }
+
+    g_assert_cmpuint(chunk.lines_length, ==, 5);
+    foreach(i, 0, count) {
+        g_assert_cmpuint(chunk_line(&chunk, i), ==, lines[i]);
+    }
+    chunk_free(&chunk);
+}
+
+static void test_constants(void) {
+    chunk_t chunk;
+
+    chunk_init(&chunk);
+    foreach(i, 0, 1000) {
+        g_assert_cmpuint(chunk_value(&chunk, NUMBER_VAL(i)), ==, i);
+    }
+    g_assert_cmpuint(chunk_value(&chunk, NUMBER_VAL(42)), ==, 42);
+    g_assert_cmpuint(chunk_value(&chunk, NUMBER_VAL(-0.0)), ==, 1000);
+
+    size_t name = chunk_value(&chunk, OBJECT_VAL(string_copy("name", 4)));
+    g_assert_cmpuint(chunk_value(&chunk, OBJECT_VAL(string_copy("name", 4))), ==, name);
+    g_assert_cmpuint(chunk_value(&chunk, BOOL_VAL(true)), !=, chunk_value(&chunk, BOOL_VAL(false)));
+    g_assert_cmpuint(chunk.constants.length, ==, 1004);
+    chunk_free(&chunk);
+}
+
+static void test_depth(void) {
+    chunk_t chunk;
+    byte_t code[] = {
+        OP_CONSTANT, 0, OP_CONSTANT, 0, OP_CONSTANT, 0, OP_ADD, OP_ADD,
+        OP_ADD_LOCALS, 0, 0, OP_POP, OP_PRINT, OP_RETURN
+    };
+
+    chunk_init(&chunk);
+    g_assert_cmpuint(chunk_depth(&chunk), ==, 0);
+    foreach(i, 0, sizeof(code)) {
+        chunk_write(&chunk, code[i], 1);
+    }
+    g_assert_cmpuint(chunk_depth(&chunk), ==, 3);
+    chunk_free(&chunk);
+
+    // The else branch starts with the condition still on the stack.
+    byte_t branches[] = {
+        OP_TRUE, OP_JUMP_IF_FALSE, 8, 0, OP_POP, OP_TRUE, OP_TRUE, OP_EQUAL, OP_POP,
+        OP_JUMP, 7, 0, OP_POP, OP_TRUE, OP_TRUE, OP_TRUE, OP_EQUAL, OP_EQUAL, OP_POP, OP_RETURN
+    };
+
+    chunk_init(&chunk);
+    foreach(i, 0, sizeof(branches)) {
+        chunk_write(&chunk, branches[i], 1);
+    }
+    g_assert_cmpuint(chunk_depth(&chunk), ==, 3);
+    chunk_free(&chunk);
+}
+
+static void test_serial(void) {
+    chunk_t chunk, loaded;
+    const char* path = "/tmp/woden_chunk_test.wnc";
+
+    chunk_init(&chunk);
+    foreach(i, 0, 100) {
+        chunk_write(&chunk, OP_CONSTANT, i / 10 + 1);
+        chunk_write(&chunk, (byte_t) chunk_value(&chunk, NUMBER_VAL(i % 7)), i / 10 + 1);
+    }
+    chunk_value(&chunk, OBJECT_VAL(string_copy("name", 4)));
+    chunk_value(&chunk, BOOL_VAL(true));
+    chunk_value(&chunk, NULL_VAL);
+    chunk.depth = chunk_depth(&chunk);
+    g_assert_true(serial_save(&chunk, path, 42));
+
+    chunk_init(&loaded);
+    g_assert_false(serial_load(&loaded, path, 43));
+    g_assert_true(serial_load(&loaded, path, 42));
+    g_assert_cmpmem(loaded.code, loaded.length, chunk.code, chunk.length);
+    g_assert_cmpuint(loaded.depth, ==, 100);
+    foreach(i, 0, chunk.length) {
+        g_assert_cmpuint(chunk_line(&loaded, i), ==, chunk_line(&chunk, i));
+    }
+    g_assert_cmpuint(loaded.constants.length, ==, chunk.constants.length);
+    foreach(i, 0, chunk.constants.length) {
+        g_assert_true(value_equal(loaded.constants.values[i], chunk.constants.values[i]));
+    }
+    chunk_free(&loaded);
+
+    FILE* file = fopen(path, "r+b");
+    g_assert_nonnull(file);
+    fseek(file, -1, SEEK_END);
+    int last = fgetc(file);
+    fseek(file, -1, SEEK_END);
+    fputc(last ^ 1, file);
+    fclose(file);
+    chunk_init(&loaded);
+    g_assert_false(serial_load(&loaded, path, 42));
+
+    chunk_free(&loaded);
+    chunk_free(&chunk);
+    remove(path);
+}
+
+static void parse(chunk_t* chunk, const char* source, bool optimize) {
+    chunk_init(chunk);
+    g_assert_true(parser_parse(chunk, source, optimize));
+}
+
+static void test_optimize(void) {
+    chunk_t chunk;
+
+    parse(&chunk, "var x = 1 + 2 * 3; program {}", true);
+    byte_t folded[] = { OP_CONSTANT, chunk.code[1], OP_DEFINE_GLOBAL, chunk.code[3], OP_RETURN };
+    g_assert_cmpmem(chunk.code, chunk.length, folded, sizeof(folded));
+    g_assert_cmpfloat(AS_NUMBER(chunk.constants.values[chunk.code[1]]), ==, 7);
+    chunk_free(&chunk);
+
+    parse(&chunk, "var x = 'a' + 'b'; var y = !true == false; program {}", true);
+    g_assert_cmpuint(chunk.code[0], ==, OP_CONSTANT);
+    g_assert_true(value_equal(chunk.constants.values[chunk.code[1]], OBJECT_VAL(string_copy("ab", 2))));
+    g_assert_cmpuint(chunk.code[4], ==, OP_TRUE);
+    chunk_free(&chunk);
+
+    parse(&chunk, "program { var a = 1; var b = 2; var c = !(a < b); }", true);
+    byte_t fused[] = { OP_GET_LOCAL, 0, OP_GET_LOCAL, 1, OP_GREATER_EQUAL, OP_POP };
+    g_assert_cmpmem(chunk.code + 4, sizeof(fused), fused, sizeof(fused));
+    chunk_free(&chunk);
+
+    parse(&chunk, "program { 1 + 2; var a = 3; a; }", true);
+    byte_t pruned[] = { OP_CONSTANT, chunk.code[1], OP_POP, OP_RETURN };
+    g_assert_cmpmem(chunk.code, chunk.length, pruned, sizeof(pruned));
+    chunk_free(&chunk);
+}
+
+// Runs `source` parsed both ways and checks that the globals in `names`
+// come out the same.
+static void assert_same_results(const char* source, const char** names, size_t count) {
+    chunk_t chunks[2];
+    vm_t* vms[2];
+
+    // Both VMs stay alive until the end, so neither one's globals are
+    // collected while the other runs.
+    for (size_t optimize = 0; optimize < 2; ++optimize) {
+        vms[optimize] = vm_create(VM_STACK);
+        parse(&chunks[optimize], source, optimize);
+        g_assert_cmpint(vm_execute(vms[optimize], &chunks[optimize]), ==, VM_SUCCESS);
+    }
+
+    foreach(i, 0, count) {
+        value_t plain, optimized;
+        g_assert_true(vm_get_global(vms[0], names[i], &plain));
+        g_assert_true(vm_get_global(vms[1], names[i], &optimized));
+        g_assert_true(value_equal(plain, optimized));
+    }
+
+    for (size_t optimize = 0; optimize < 2; ++optimize) {
+        vm_destroy(vms[optimize]);
+        chunk_free(&chunks[optimize]);
+    }
+}
+
+static void test_optimize_results(void) {
+    const char* names[] = { "a", "b", "c", "d", "e" };
+    assert_same_results(
+        "var a = 1 + 2 * 3 - 4 / 2; var b = 'wo' + 'den'; var c = !(1 < 2) == (3 >= 4); "
+        "var d = -(2 * 3) % 4; var e = !(a <= 5) != !!null; "
+        "program { var l = a; l; 1 + 2; b = b + '!'; e = !(l > 2); }", names, 5);
+}
+
+static bool emits(const char* source, byte_t operation) {
+    chunk_t chunk;
+    bool found = false;
+    parse(&chunk, source, true);
+    for (size_t offset = 0; offset < chunk.length; offset += chunk_operation_size(chunk.code[offset])) {
+        found |= chunk.code[offset] == operation;
+    }
+    chunk_free(&chunk);
+    return found;
+}
+
+static void test_counted_loops(void) {
+    g_assert_true(emits("program { var n = 3; for (var i = 0; i < n; i = i + 1) {} }", OP_FOR_LESS_LOCAL));
+    g_assert_true(emits("program { for (var i = 0; i < 3; i = i + 1) {} }", OP_FOR_LESS_CONSTANT));
+    g_assert_false(emits("program { var n = 3; for (var i = 0; i < n; i = i + 1) { n = 2; } }", OP_FOR_LESS_LOCAL));
+    g_assert_false(emits("program { for (var i = 0; i < 3; i = i + 1) { i = i + 1; } }", OP_FOR_LESS_CONSTANT));
+
+    const char* names[] = { "a", "b", "c" };
+    assert_same_results(
+        "var a = 0; var b = 0; var c = 0; "
+        "program { "
+        "for (var i = -2; i < 1; i = i + 0.25) { a = a + i; } "
+        "var n = 0.7; for (var j = 0; j < n; j = j + 0.1) { b = b + 1; } "
+        "for (var k = 5; k < 3; k = k + -1) { c = c + 1; } "
+        "}", names, 3);
+}
@@ -0,0 +1,93 @@
+/* VArray Test - Tests for VArray
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include <glib.h>
+
+#include "test.h"
+#include "gc.h"
+#include "object.h"
+
+#define TEST_PATH "/gc"
+
+static void test_main(void);
+static void test_pin(void);
+static void test_free(void);
+
+extern void add_gc_tests(void) {
+    g_test_add_func(TEST_PATH, test_main);
+    g_test_add_func(TEST_PATH "/pin", test_pin);
+    g_test_add_func(TEST_PATH "/free", test_free);
+}
+
+static void mark_roots(void* data) {
+    gc_mark_value(*(value_t*) data);
+}
+
+static void mark_nothing(void* data) {
+    (void) data;
+}
+
+static void test_main(void) {
+    value_t root = OBJECT_VAL(string_copy("root", 4));
+    string_copy("garbage", 7);
+
+    gc_stats_t before = gc_stats();
+    gc_collect(mark_roots, &root);
+    gc_stats_t after = gc_stats();
+
+    g_assert_cmpuint(after.collections, ==, before.collections + 1);
+    g_assert_cmpuint(after.last_freed_bytes, >=, sizeof(string_t) + 8);
+    g_assert_cmpuint(after.live_bytes, ==, before.live_bytes - after.last_freed_bytes);
+    g_assert_true(string_copy("root", 4) == AS_STRING(root));
+    g_assert_false(AS_STRING(root)->object.marked);
+}
+
+static void test_pin(void) {
+    value_t pinned = OBJECT_VAL(string_copy("pinned", 6));
+
+    gc_pin(pinned);
+    gc_collect(mark_nothing, NULL);
+    g_assert_true(string_copy("pinned", 6) == AS_STRING(pinned));
+
+    gc_unpin(pinned);
+    gc_collect(mark_nothing, NULL);
+    g_assert_cmpuint(gc_stats().last_freed_bytes, >=, sizeof(string_t) + 7);
+}
+
+// Frees the heap of its own thread, so the one the other tests share
+// is left alone.
+static void* free_heap(void* data) {
+    (void) data;
+    gc_pin(OBJECT_VAL(string_copy("pinned", 6)));
+    gc_free();
+    string_t* string = string_copy("pinned", 6);
+    bool fresh = string->size == 6 && gc_stats().live_bytes > 0;
+    gc_free();
+    return (void*)(uintptr_t) fresh;
+}
+
+static void test_free(void) {
+    pthread_t thread;
+    void* fresh;
+    g_assert_cmpint(pthread_create(&thread, NULL, free_heap, NULL), ==, 0);
+    g_assert_cmpint(pthread_join(thread, &fresh), ==, 0);
+    g_assert_true(fresh != NULL);
+}
@@ -24,5 +24,10 @@
 int main(int argc, char* argv[]) {
     g_test_init(&argc, &argv, NULL);
     add_varray_tests();
+    add_value_tests();
+    add_table_tests();
+    add_gc_tests();
+    add_chunk_tests();
+    add_vm_tests();
     return g_test_run();
 }
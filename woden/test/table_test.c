@@ -0,0 +1,86 @@
+/* VArray Test - Tests for VArray
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <glib.h>
+
+#include "test.h"
+#include "table.h"
+#include "object.h"
+
+#define KEYS 100
+#define TEST_PATH "/table"
+
+#define foreach(index, from, to) \
+    for (size_t index = from; index < to; ++index)
+
+static void test_main(void);
+
+extern void add_table_tests(void) {
+    g_test_add_func(TEST_PATH, test_main);
+}
+
+static string_t* make_key(size_t index) {
+    char buffer[16];
+    int size = sprintf(buffer, "key%zu", index);
+    return string_copy(buffer, (size_t) size);
+}
+
+static void test_main(void) {
+    table_t table;
+    string_t* keys[KEYS];
+
+    table_init(&table);
+    foreach(i, 0, KEYS) {
+        keys[i] = make_key(i);
+        g_assert_true(table_set(&table, keys[i], NUMBER_VAL(i)));
+    }
+
+    foreach(i, 0, KEYS) {
+        value_t* value = table_get(&table, keys[i]);
+        g_assert_nonnull(value);
+        g_assert_cmpint(i, ==, AS_NUMBER(*value));
+    }
+
+    size_t version = table.version;
+    value_t* seven = table_get(&table, keys[7]);
+    g_assert_false(table_set(&table, keys[7], NUMBER_VAL(-7)));
+    g_assert_cmpint(-7, ==, AS_NUMBER(*seven));
+    g_assert_cmpuint(table.version, ==, version);
+
+    foreach(i, 0, KEYS) {
+        if (i % 2) g_assert_true(table_delete(&table, keys[i]));
+    }
+    g_assert_cmpuint(table.version, >, version);
+    g_assert_false(table_delete(&table, keys[1]));
+
+    foreach(i, 0, KEYS) {
+        value_t* value = table_get(&table, keys[i]);
+        if (i % 2) {
+            g_assert_null(value);
+        } else {
+            g_assert_nonnull(value);
+        }
+    }
+
+    g_assert_true(table_set(&table, keys[1], NULL_VAL));
+    g_assert_nonnull(table_get(&table, keys[1]));
+    g_assert_null(table_get(&table, make_key(KEYS)));
+    table_free(&table);
+}
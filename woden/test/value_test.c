@@ -0,0 +1,61 @@
+/* VArray Test - Tests for VArray
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+
+#include "test.h"
+#include "value.h"
+#include "object.h"
+
+#define TEST_PATH "/value"
+
+static void test_main(void);
+
+extern void add_value_tests(void) {
+    g_test_add_func(TEST_PATH, test_main);
+}
+
+static void test_main(void) {
+    value_t number = NUMBER_VAL(-2.5);
+    g_assert_true(IS_NUMBER(number));
+    g_assert_false(IS_BOOL(number) || IS_NULL(number) || IS_OBJECT(number));
+    g_assert_cmpfloat(AS_NUMBER(number), ==, -2.5);
+
+    value_t boolean = BOOL_VAL(true);
+    g_assert_true(IS_BOOL(boolean));
+    g_assert_false(IS_NUMBER(boolean) || IS_NULL(boolean) || IS_OBJECT(boolean));
+    g_assert_true(AS_BOOL(boolean));
+    g_assert_false(AS_BOOL(BOOL_VAL(false)));
+
+    value_t null = NULL_VAL;
+    g_assert_true(IS_NULL(null));
+    g_assert_false(IS_NUMBER(null) || IS_BOOL(null) || IS_OBJECT(null));
+
+    string_t* string = string_copy("woden", 5);
+    value_t object = OBJECT_VAL(string);
+    g_assert_true(IS_STRING(object));
+    g_assert_false(IS_NUMBER(object) || IS_BOOL(object) || IS_NULL(object));
+    g_assert_true(AS_STRING(object) == string);
+    g_assert_true(string_copy("woden", 5) == string);
+
+    g_assert_true(value_equal(NUMBER_VAL(0.0), NUMBER_VAL(-0.0)));
+    g_assert_false(value_equal(NUMBER_VAL(0.0 / 0.0), NUMBER_VAL(0.0 / 0.0)));
+    g_assert_true(value_equal(object, OBJECT_VAL(string_copy("woden", 5))));
+    g_assert_false(value_equal(NULL_VAL, BOOL_VAL(false)));
+}
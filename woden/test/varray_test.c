@@ -29,9 +29,11 @@
     for (size_t index = from; index < to; ++index)
 
 static void test_main(void);
+static void test_arena(void);
 
 extern void add_varray_tests(void) {
     g_test_add_func(TEST_PATH, test_main);
+    g_test_add_func(TEST_PATH "/arena", test_arena);
 }
 
 static void test_main(void) {
@@ -48,3 +50,26 @@ static void test_main(void) {
     }
     varray_free(&array);
 }
+
+static void test_arena(void) {
+    arena_t arena;
+    varray_t small, large;
+
+    arena_init(&arena);
+    varray_init_arena(&small, &arena);
+    varray_init_arena(&large, &arena);
+    foreach(i, 0, 100000) {
+        varray_push(&large, NUMBER_VAL(i));
+        if (i % 1000 == 0) {
+            varray_push(&small, NUMBER_VAL(i));
+        }
+    }
+
+    foreach(i, 0, 100000) {
+        g_assert_cmpint(i, ==, AS_NUMBER(large.values[i]));
+    }
+    foreach(i, 0, 100) {
+        g_assert_cmpint(i * 1000, ==, AS_NUMBER(small.values[i]));
+    }
+    arena_free(&arena);
+}
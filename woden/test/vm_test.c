@@ -0,0 +1,310 @@
+/* VM Test - Tests for VM
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include <glib.h>
+
+#include "test.h"
+#include "vm.h"
+#include "object.h"
+#include "parser.h"
+#include "gc.h"
+
+#define TEST_PATH "/vm"
+
+static void test_globals(void);
+static void test_instances(void);
+static void test_call(void);
+static void test_quicken(void);
+static void test_fallback(void);
+static void test_engines(void);
+static void test_threads(void);
+static void test_tail_calls(void);
+static void test_control_flow(void);
+static void test_short_circuit(void);
+static void test_long_jumps(void);
+
+extern void add_vm_tests(void) {
+    g_test_add_func(TEST_PATH "/globals", test_globals);
+    g_test_add_func(TEST_PATH "/instances", test_instances);
+    g_test_add_func(TEST_PATH "/call", test_call);
+    g_test_add_func(TEST_PATH "/quicken", test_quicken);
+    g_test_add_func(TEST_PATH "/fallback", test_fallback);
+    g_test_add_func(TEST_PATH "/engines", test_engines);
+    g_test_add_func(TEST_PATH "/threads", test_threads);
+    g_test_add_func(TEST_PATH "/tail_calls", test_tail_calls);
+    g_test_add_func(TEST_PATH "/control_flow", test_control_flow);
+    g_test_add_func(TEST_PATH "/control_flow/short_circuit", test_short_circuit);
+    g_test_add_func(TEST_PATH "/control_flow/long_jumps", test_long_jumps);
+}
+
+static void test_globals(void) {
+    vm_t* vm = vm_create(VM_STACK);
+    value_t value;
+
+    g_assert_cmpint(vm_interpret(vm, "var x = 1; program {}"), ==, VM_SUCCESS);
+    g_assert_cmpint(vm_interpret(vm, "program { x = x + 41; }"), ==, VM_SUCCESS);
+    g_assert_true(vm_get_global(vm, "x", &value));
+    g_assert_cmpfloat(AS_NUMBER(value), ==, 42);
+
+    vm_set_global(vm, "y", NUMBER_VAL(8));
+    g_assert_cmpint(vm_interpret(vm, "program { x = x + y; }"), ==, VM_SUCCESS);
+    g_assert_true(vm_get_global(vm, "x", &value));
+    g_assert_cmpfloat(AS_NUMBER(value), ==, 50);
+
+    g_assert_cmpint(vm_interpret(vm, "program { x = }"), ==, VM_SYNTAX_ERROR);
+    g_assert_false(vm_get_global(vm, "z", &value));
+    vm_destroy(vm);
+}
+
+static void test_instances(void) {
+    vm_t* first = vm_create(VM_STACK);
+    vm_t* second = vm_create(VM_REGISTERS);
+    value_t value;
+
+    vm_interpret(first, "var x = 'first'; program {}");
+    vm_interpret(second, "var x = 2; program {}");
+    g_assert_true(vm_get_global(first, "x", &value));
+    g_assert_true(IS_STRING(value));
+    g_assert_true(vm_get_global(second, "x", &value));
+    g_assert_cmpfloat(AS_NUMBER(value), ==, 2);
+
+    vm_destroy(first);
+    g_assert_true(vm_get_global(second, "x", &value));
+    vm_destroy(second);
+}
+
+static void test_call(void) {
+    vm_t* vm = vm_create(VM_STACK);
+    value_t args[] = { NUMBER_VAL(40), NUMBER_VAL(2) };
+    value_t result;
+
+    g_assert_cmpint(vm_interpret(vm, "function add(a, b) { return a + b; } program {}"), ==, VM_SUCCESS);
+    g_assert_cmpint(vm_call(vm, "add", args, 2, &result), ==, VM_SUCCESS);
+    g_assert_cmpfloat(AS_NUMBER(result), ==, 42);
+
+    g_assert_cmpint(vm_call(vm, "add", args, 1, &result), ==, VM_RUNTIME_ERROR);
+    g_assert_cmpint(vm_call(vm, "missing", args, 0, &result), ==, VM_RUNTIME_ERROR);
+    g_assert_cmpint(vm_call(vm, "add", args, 2, &result), ==, VM_SUCCESS);
+    vm_destroy(vm);
+}
+
+static void test_quicken(void) {
+    vm_t* vm = vm_create(VM_STACK);
+    value_t args[] = { NUMBER_VAL(2), NUMBER_VAL(3) };
+    value_t result;
+
+    g_assert_cmpint(vm_interpret(vm,
+        "function add(a, b) { return a + b; } "
+        "program { var x = add(1, 2); var y = add('a', 'b'); }"), ==, VM_SUCCESS);
+    g_assert_cmpuint(vm_stats(vm).quickened, ==, 1);
+    g_assert_cmpuint(vm_stats(vm).deopted, ==, 1);
+
+    g_assert_cmpint(vm_call(vm, "add", args, 2, &result), ==, VM_SUCCESS);
+    g_assert_cmpfloat(AS_NUMBER(result), ==, 5);
+    g_assert_cmpuint(vm_stats(vm).quickened, ==, 1);
+    vm_destroy(vm);
+}
+
+static void test_fallback(void) {
+    vm_t* vm = vm_create(VM_REGISTERS);
+
+    g_assert_cmpint(vm_interpret(vm, "var x = 1; program { x = x + 1; }"), ==, VM_SUCCESS);
+    g_assert_cmpuint(vm_stats(vm).fallbacks, ==, 0);
+
+    g_assert_cmpint(vm_interpret(vm, "function f() { return 1; } program { x = f(); }"), ==, VM_SUCCESS);
+    g_assert_cmpuint(vm_stats(vm).fallbacks, ==, 1);
+    vm_destroy(vm);
+}
+
+// Runs `source` on a new VM, keeping the chunk for the caller to free
+// once it is done with the VM.
+static vm_t* run(chunk_t* chunk, const char* source, vm_engine_t engine, bool optimize) {
+    vm_t* vm = vm_create(engine);
+    chunk_init(chunk);
+    g_assert_true(parser_parse(chunk, source, optimize));
+    g_assert_cmpint(vm_execute(vm, chunk), ==, VM_SUCCESS);
+    return vm;
+}
+
+static void test_engines(void) {
+    const char* corpus[] = {
+        "var a = 0; var b = 0; var c = 0; "
+        "program { var x = 7; var y = 3; a = x * y - x / y + x % y; b = -a; c = (x = x + 1) * 2; a = a + x; }",
+        "var s = ''; var t = false; "
+        "program { var n = 5; s = 'wo' + 'den'; t = n >= 5 == !(n < 5); s = s + s; }",
+        "var r = 0; "
+        "program { var i = 0; while (i < 10) { if (i % 2 == 0) { r = r + i; } else { r = r - 1; } i = i + 1; } }",
+        "var r = 0; "
+        "program { for (var i = 0; i < 10; i = i + 1) { for (var j = 0; j < i; j = j + 0.5) { r = r + j; } } "
+        "var n = 4; for (var k = 0; k < n; k = k + 1) { r = r * 2; } }",
+        "var a = false; var b = false; var c = 0; "
+        "program { var x = 1; var y = null; a = x && y; b = y || x; c = x > 0 && (c = 5) || 7; }"
+    };
+    const char* globals[] = { "a", "b", "c", "r", "s", "t" };
+
+    for (size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); ++i) {
+        chunk_t chunks[4];
+        vm_t* vms[4];
+        for (size_t run_index = 0; run_index < 4; ++run_index) {
+            vm_engine_t engine = run_index & 1 ? VM_REGISTERS : VM_STACK;
+            vms[run_index] = run(&chunks[run_index], corpus[i], engine, run_index & 2);
+            g_assert_cmpuint(vm_stats(vms[run_index]).fallbacks, ==, 0);
+        }
+
+        for (size_t j = 0; j < sizeof(globals) / sizeof(globals[0]); ++j) {
+            value_t expected;
+            if (!vm_get_global(vms[0], globals[j], &expected)) {
+                continue;
+            }
+            for (size_t run_index = 1; run_index < 4; ++run_index) {
+                value_t value;
+                g_assert_true(vm_get_global(vms[run_index], globals[j], &value));
+                g_assert_true(value_equal(value, expected));
+            }
+        }
+
+        for (size_t run_index = 0; run_index < 4; ++run_index) {
+            vm_destroy(vms[run_index]);
+            chunk_free(&chunks[run_index]);
+        }
+    }
+}
+
+// Each thread runs the shared chunk a few times on a VM of its own and
+// reports whether every run left the expected globals.
+static void* run_shared(void* data) {
+    chunk_t* chunk = (chunk_t*) data;
+    vm_t* vm = vm_create(VM_STACK);
+    bool passed = true;
+    for (size_t i = 0; i < 3; ++i) {
+        value_t n, s;
+        passed &= vm_execute(vm, chunk) == VM_SUCCESS
+            && vm_get_global(vm, "n", &n) && IS_NUMBER(n) && AS_NUMBER(n) == 39600
+            && vm_get_global(vm, "s", &s) && IS_STRING(s) && AS_STRING(s)->size == 203;
+    }
+    vm_destroy(vm);
+    gc_free();
+    return (void*)(uintptr_t) passed;
+}
+
+static void test_threads(void) {
+    chunk_t chunk;
+    pthread_t threads[4];
+
+    chunk_init(&chunk);
+    g_assert_true(parser_parse(&chunk,
+        "var n = 0; var s = ''; function add(a, b) { return a + b; } "
+        "program { for (var i = 0; i < 200; i = i + 1) { n = add(n, i * 2 - 1); s = add(s, 'x'); } "
+        "s = s + 'end'; }", true));
+
+    for (size_t i = 0; i < 4; ++i) {
+        g_assert_cmpint(pthread_create(&threads[i], NULL, run_shared, &chunk), ==, 0);
+    }
+    for (size_t i = 0; i < 4; ++i) {
+        void* passed;
+        g_assert_cmpint(pthread_join(threads[i], &passed), ==, 0);
+        g_assert_true(passed != NULL);
+    }
+    chunk_free(&chunk);
+}
+
+static void test_tail_calls(void) {
+    // Far deeper than the frame stack, so every call must reuse its frame.
+    const char* source =
+        "var r = 0; "
+        "function loop(n, total) { if (n == 0) { return total; } return loop(n - 1, total + 2); } "
+        "program { r = loop(100000, 0); }";
+
+    for (size_t optimize = 0; optimize < 2; ++optimize) {
+        chunk_t chunk;
+        value_t r;
+        vm_t* vm = run(&chunk, source, VM_STACK, optimize);
+        g_assert_true(vm_get_global(vm, "r", &r));
+        g_assert_cmpfloat(AS_NUMBER(r), ==, 200000);
+        vm_destroy(vm);
+        chunk_free(&chunk);
+    }
+}
+
+static value_t global(vm_t* vm, const char* name) {
+    value_t value;
+    g_assert_true(vm_get_global(vm, name, &value));
+    return value;
+}
+
+static void test_control_flow(void) {
+    vm_t* vm = vm_create(VM_STACK);
+
+    g_assert_cmpint(vm_interpret(vm,
+        "var a = 0; var b = 0; var c = 0; var d = 0; "
+        "program { "
+        "if (1 < 2) { a = 1; } else { a = 2; } "
+        "if (a > 1) { b = 1; } else { b = 2; } "
+        "var i = 0; while (i < 5) { c = c + i; i = i + 1; } "
+        "for (var j = 0; j < 4; j = j + 1) { for (var k = 0; k < j; k = k + 1) { d = d + 1; } } "
+        "}"), ==, VM_SUCCESS);
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "a")), ==, 1);
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "b")), ==, 2);
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "c")), ==, 10);
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "d")), ==, 6);
+    vm_destroy(vm);
+}
+
+static void test_short_circuit(void) {
+    vm_t* vm = vm_create(VM_STACK);
+
+    // The assignments on the right would show if it were evaluated.
+    g_assert_cmpint(vm_interpret(vm,
+        "var e = 0; var f = 0; var g = 0; var h = 0; "
+        "program { g = false && (e = 1); h = 2 || (f = 1); }"), ==, VM_SUCCESS);
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "e")), ==, 0);
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "f")), ==, 0);
+    g_assert_false(AS_BOOL(global(vm, "g")));
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "h")), ==, 2);
+
+    g_assert_cmpint(vm_interpret(vm, "program { g = true && (e = 3); h = null || (f = 4); }"), ==, VM_SUCCESS);
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "e")), ==, 3);
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "f")), ==, 4);
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "g")), ==, 3);
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "h")), ==, 4);
+    vm_destroy(vm);
+}
+
+static void test_long_jumps(void) {
+    static const char body[] = "x = x + 1; ";
+    char source[8192] = "var x = 0; var y = 0; program { if (y == 1) { ";
+
+    // Each statement is several bytes of code, so both jumps and the
+    // loop need the high byte of their offset.
+    for (size_t i = 0; i < 100; ++i) {
+        strcat(source, body);
+    }
+    strcat(source, "} var i = 0; while (i < 3) { ");
+    for (size_t i = 0; i < 100; ++i) {
+        strcat(source, body);
+    }
+    strcat(source, "i = i + 1; } }");
+
+    vm_t* vm = vm_create(VM_STACK);
+    g_assert_cmpint(vm_interpret(vm, source), ==, VM_SUCCESS);
+    g_assert_cmpfloat(AS_NUMBER(global(vm, "x")), ==, 300);
+    vm_destroy(vm);
+}
@@ -0,0 +1,164 @@
+/* Ngrams - Mine frequent opcode sequences from a VM trace
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Reads a trace written by a WODEN_OPCODE_TRACE build (one byte per
+// executed opcode) and prints the most frequent sequences of 2..N
+// opcodes, as candidates for superinstructions.
+//
+//     WODEN_TRACE=script.trace woden script.wn
+//     ngrams [-n 4] [-k 20] script.trace
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "debug.h"
+
+#define MAX_LENGTH 4
+#define BASE_SIZE 1024
+
+typedef struct ngram ngram_t;
+typedef struct counter counter_t;
+
+struct ngram {
+    uint32_t key;
+    uint64_t count;
+};
+
+struct counter {
+    size_t size;
+    size_t length;
+    ngram_t* ngrams;
+};
+
+static inline size_t key_hash(uint32_t key) {
+    return (size_t)(key * 2654435761u);
+}
+
+static ngram_t* counter_find(ngram_t* ngrams, size_t size, uint32_t key) {
+    for (size_t index = key_hash(key) & (size - 1);; index = (index + 1) & (size - 1)) {
+        if (ngrams[index].count == 0 || ngrams[index].key == key) {
+            return &ngrams[index];
+        }
+    }
+}
+
+static void counter_add(counter_t* counter, uint32_t key) {
+    if (counter->length + 1 > counter->size / 4 * 3) {
+        size_t size = counter->size ? counter->size * 2 : BASE_SIZE;
+        ngram_t* ngrams = calloc(size, sizeof(ngram_t));
+        for (size_t i = 0; i < counter->size; ++i) {
+            if (counter->ngrams[i].count) {
+                *counter_find(ngrams, size, counter->ngrams[i].key) = counter->ngrams[i];
+            }
+        }
+        free(counter->ngrams);
+        counter->ngrams = ngrams;
+        counter->size = size;
+    }
+
+    ngram_t* ngram = counter_find(counter->ngrams, counter->size, key);
+    if (ngram->count++ == 0) {
+        ngram->key = key;
+        ++counter->length;
+    }
+}
+
+static int compare_ngrams(const void* x, const void* y) {
+    uint64_t a = ((const ngram_t*) x)->count;
+    uint64_t b = ((const ngram_t*) y)->count;
+    return a < b ? 1 : a > b ? -1 : 0;
+}
+
+static void print_ngram(uint32_t key, size_t length) {
+    for (size_t i = length; i-- > 0;) {
+        byte_t operation = (byte_t)(key >> (8 * i));
+        const char* name = operation_name(operation);
+        if (name != NULL) {
+            printf(" %s", name);
+        } else {
+            printf(" %d", operation);
+        }
+    }
+    printf("\n");
+}
+
+static void print_top(counter_t* counter, size_t length, size_t top, uint64_t total) {
+    size_t count = 0;
+    for (size_t i = 0; i < counter->size; ++i) {
+        if (counter->ngrams[i].count) {
+            counter->ngrams[count++] = counter->ngrams[i];
+        }
+    }
+    qsort(counter->ngrams, count, sizeof(ngram_t), compare_ngrams);
+
+    printf("== %zu-grams ==\n", length);
+    for (size_t i = 0; i < count && i < top; ++i) {
+        printf("%12" PRIu64 " %5.1f%% ", counter->ngrams[i].count, 100.0 * counter->ngrams[i].count / total);
+        print_ngram(counter->ngrams[i].key, length);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t length = 3;
+    size_t top = 20;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            length = (size_t) atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+            top = (size_t) atoi(argv[++i]);
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (path == NULL || length < 2 || length > MAX_LENGTH) {
+        fprintf(stderr, "Usage: ngrams [-n 2..%d] [-k top] trace\n", MAX_LENGTH);
+        return 64;
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return 74;
+    }
+
+    counter_t counters[MAX_LENGTH + 1] = { 0 };
+    uint32_t window = 0;
+    uint64_t total = 0;
+    for (int byte; (byte = getc(file)) != EOF;) {
+        window = window << 8 | (uint32_t) byte;
+        ++total;
+        for (size_t n = 2; n <= length && n <= total; ++n) {
+            uint32_t mask = n == 4 ? UINT32_MAX : (1u << (8 * n)) - 1;
+            counter_add(&counters[n], window & mask);
+        }
+    }
+    fclose(file);
+
+    printf("%" PRIu64 " operations\n", total);
+    for (size_t n = 2; n <= length; ++n) {
+        print_top(&counters[n], n, top, total);
+        free(counters[n].ngrams);
+    }
+    return 0;
+}
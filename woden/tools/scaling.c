@@ -0,0 +1,153 @@
+/* Scaling - Measure how script throughput scales with threads
+ * Copyright (C) 2021 Stan Vlad <vstan02@protonmail.com>
+ *
+ * This file is part of Woden.
+ *
+ * Woden is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Compiles a script once and runs it on 1, 2, 4, ... threads, each with
+// its own VM over the shared chunk, reporting runs per second and the
+// speedup over one thread. Script output is discarded and the results
+// go to stderr.
+//
+//     scaling [-t 8] [-n 1000] script.wn
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "parser.h"
+#include "vm.h"
+#include "gc.h"
+
+typedef struct worker worker_t;
+
+struct worker {
+    pthread_t thread;
+    chunk_t* chunk;
+    size_t runs;
+    bool failed;
+};
+
+static double clock_seconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec / 1e9;
+}
+
+static char* read_script(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t size = (size_t) ftell(file);
+    rewind(file);
+
+    char* source = malloc(size + 1);
+    source[fread(source, 1, size, file)] = '\0';
+    fclose(file);
+    return source;
+}
+
+static void* run_worker(void* data) {
+    worker_t* worker = (worker_t*) data;
+    vm_t* vm = vm_create(VM_STACK);
+    for (size_t i = 0; i < worker->runs; ++i) {
+        worker->failed |= vm_execute(vm, worker->chunk) != VM_SUCCESS;
+    }
+    vm_destroy(vm);
+    gc_free();
+    return NULL;
+}
+
+static double measure(chunk_t* chunk, size_t threads, size_t runs, bool* failed) {
+    worker_t* workers = calloc(threads, sizeof(worker_t));
+    double start = clock_seconds();
+    for (size_t i = 0; i < threads; ++i) {
+        workers[i] = (worker_t) { .chunk = chunk, .runs = runs };
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        *failed |= workers[i].failed;
+    }
+    double time = clock_seconds() - start;
+    free(workers);
+    return time;
+}
+
+int main(int argc, char** argv) {
+    size_t max_threads = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+    size_t runs = 1000;
+    int option;
+    while ((option = getopt(argc, argv, "t:n:")) != -1) {
+        switch (option) {
+            case 't': max_threads = strtoul(optarg, NULL, 10); break;
+            case 'n': runs = strtoul(optarg, NULL, 10); break;
+            default: optind = argc + 1; break;
+        }
+    }
+
+    if (optind != argc - 1 || max_threads == 0 || runs == 0) {
+        fprintf(stderr, "Usage: scaling [-t threads] [-n runs] path\n");
+        return 64;
+    }
+
+    char* source = read_script(argv[optind]);
+    if (source == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", argv[optind]);
+        return 74;
+    }
+
+    chunk_t chunk;
+    chunk_init(&chunk);
+    if (!parser_parse(&chunk, source, true)) {
+        return 65;
+    }
+    free(source);
+
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        return 74;
+    }
+
+    bool failed = false;
+    double base = 0;
+    fprintf(stderr, "threads  runs/s      speedup\n");
+    for (size_t threads = 1;; threads *= 2) {
+        if (threads > max_threads) {
+            threads = max_threads;
+        }
+
+        double rate = (double)(threads * runs) / measure(&chunk, threads, runs, &failed);
+        if (threads == 1) {
+            base = rate;
+        }
+        fprintf(stderr, "%-8zu %-11.0f %.2fx\n", threads, rate, rate / base);
+
+        if (threads == max_threads) {
+            break;
+        }
+    }
+
+    chunk_free(&chunk);
+    gc_free();
+    return failed ? 70 : 0;
+}